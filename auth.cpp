@@ -0,0 +1,266 @@
+#include "auth.hpp"
+#include "crypto.hpp"
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <stdlib.h>
+#include <pthread.h>
+
+#define MAX_TRACKED_SOURCES 4096
+#define MAX_CACHED_CREDENTIALS 1024
+
+std::string hashPassword(const std::string& password, unsigned int iterations)
+{
+    std::string salt;
+    if (!randomBytes(salt, PASSWORD_SALT_SIZE)) return "";
+    std::string hash = pbkdf2Sha256(password, salt, iterations, PASSWORD_HASH_SIZE);
+    return PASSWORD_HASH_SCHEME "$" + std::to_string(iterations) + "$" + toHex(salt) + "$" + toHex(hash);
+}
+
+// Splits "scheme$iterations$salt$hash" into its decoded parts
+static bool parseHash(const std::string& stored, unsigned int& iterations, std::string& salt, std::string& hash)
+{
+    std::string fields[4];
+    size_t begin = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        size_t end = i < 3 ? stored.find('$', begin) : stored.length();
+        if (end == std::string::npos) return false;
+        fields[i] = stored.substr(begin, end - begin);
+        begin = end + 1;
+    }
+    if (fields[0] != PASSWORD_HASH_SCHEME || fields[1].empty() || fields[1].find_first_not_of("0123456789") != std::string::npos) return false;
+
+    unsigned long count = strtoul(fields[1].c_str(), nullptr, 10);
+    if (count == 0 || count > MAX_HASH_ITERATIONS) return false;
+    iterations = static_cast<unsigned int>(count);
+    return fromHex(fields[2], salt) && fromHex(fields[3], hash) && !salt.empty() && !hash.empty();
+}
+
+bool isPasswordHash(const std::string& stored)
+{
+    unsigned int iterations;
+    std::string salt, hash;
+    return parseHash(stored, iterations, salt, hash);
+}
+
+bool verifyPassword(const std::string& password, const std::string& stored)
+{
+    unsigned int iterations;
+    std::string salt, hash;
+    if (!parseHash(stored, iterations, salt, hash)) return !stored.empty() && constantTimeEquals(password, stored);
+    return constantTimeEquals(pbkdf2Sha256(password, salt, iterations, hash.length()), hash);
+}
+
+static double monotonicSeconds()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+CredentialVerifier::CredentialVerifier(const AuthConfig& config, AccountLookup find_account) : config(config), find_account(std::move(find_account))
+{
+    if (this->config.workers == 0) this->config.workers = std::max(1u, std::thread::hardware_concurrency() / 2);
+    if (!randomBytes(cache_key, 32)) this->config.cache_ttl = 0;
+}
+
+CredentialVerifier::~CredentialVerifier()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for (auto& worker : threads) worker.join();
+}
+
+void CredentialVerifier::start()
+{
+    // Workers leave the drain and report signals to the main thread, like session threads
+    sigset_t signals, previous;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, &previous);
+    for (size_t i = 0; i < config.workers; ++i) threads.emplace_back(&CredentialVerifier::workerLoop, this);
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+}
+
+void CredentialVerifier::workerLoop()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while (true)
+    {
+        work_ready.wait(guard, [this] { return stopping || !queue.empty(); });
+        if (queue.empty()) return;
+
+        Job* job = queue.front();
+        queue.pop_front();
+        guard.unlock();
+
+        VerifyResult result = process(*job);
+
+        guard.lock();
+        job->result = result;
+        job->done = true;
+        job->finished.notify_one();
+    }
+}
+
+VerifyResult CredentialVerifier::process(const Job& job)
+{
+    // Unknown users are checked against this, so they cost the same time as a wrong password
+    static const std::string unknown_user = hashPassword("");
+
+    std::string stored;
+    ResourcePolicy limits;
+    bool known = find_account(*job.username, stored, limits);
+    if (job.password == nullptr)
+    {
+        if (!known) return VerifyResult::Rejected;
+        *job.limits = limits;
+        return VerifyResult::Accepted;
+    }
+
+    std::string entry;
+    if (config.cache_ttl > 0 && known)
+    {
+        entry = cacheEntry(*job.username, *job.password, stored);
+        std::lock_guard<std::mutex> guard(limits_lock);
+        auto cached = verified.find(entry);
+        if (cached != verified.end() && cached->second > time(nullptr))
+        {
+            cache_hits++;
+            *job.limits = limits;
+            return VerifyResult::Accepted;
+        }
+    }
+
+    if (!takeAttempt(*job.source))
+    {
+        rate_limited++;
+        return VerifyResult::RateLimited;
+    }
+
+    bool accepted;
+    // Plaintext entries are a plain comparison, not a hash
+    if (known && !isPasswordHash(stored)) accepted = verifyPassword(*job.password, stored);
+    else
+    {
+        accepted = verifyPassword(*job.password, known ? stored : unknown_user) && known;
+        hashed++;
+    }
+    if (!accepted) return VerifyResult::Rejected;
+
+    if (!entry.empty())
+    {
+        time_t now = time(nullptr);
+        std::lock_guard<std::mutex> guard(limits_lock);
+        if (verified.size() >= MAX_CACHED_CREDENTIALS)
+        {
+            for (auto it = verified.begin(); it != verified.end(); )
+            {
+                if (it->second <= now) it = verified.erase(it);
+                else ++it;
+            }
+        }
+        if (verified.size() < MAX_CACHED_CREDENTIALS) verified[entry] = now + config.cache_ttl;
+    }
+    *job.limits = limits;
+    return VerifyResult::Accepted;
+}
+
+VerifyResult CredentialVerifier::submit(Job& job)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    if (queue.size() >= config.queue_limit)
+    {
+        busy++;
+        return VerifyResult::Busy;
+    }
+    queue.push_back(&job);
+    work_ready.notify_one();
+    job.finished.wait(guard, [&job] { return job.done; });
+    return job.result;
+}
+
+// Whether the source could take an attempt now, without taking it or starting to track the source
+bool CredentialVerifier::hasAttempt(const std::string& source)
+{
+    std::lock_guard<std::mutex> guard(limits_lock);
+    auto found = buckets.find(source);
+    if (found == buckets.end()) return true;
+    double refill = config.attempts_per_minute / 60;
+    return found->second.tokens + (monotonicSeconds() - found->second.updated) * refill >= 1;
+}
+
+// Token bucket per source: a burst of attempts, then attempts_per_minute
+bool CredentialVerifier::takeAttempt(const std::string& source)
+{
+    double now = monotonicSeconds();
+    double refill = config.attempts_per_minute / 60;
+    std::lock_guard<std::mutex> guard(limits_lock);
+
+    // Sources that have been quiet long enough to be back at a full bucket needn't be remembered
+    if (buckets.size() >= MAX_TRACKED_SOURCES)
+    {
+        for (auto it = buckets.begin(); it != buckets.end(); )
+        {
+            if (it->second.tokens + (now - it->second.updated) * refill >= config.attempt_burst) it = buckets.erase(it);
+            else ++it;
+        }
+    }
+
+    auto found = buckets.find(source);
+    if (found == buckets.end()) found = buckets.emplace(source, AttemptBucket{config.attempt_burst, now}).first;
+
+    AttemptBucket& bucket = found->second;
+    bucket.tokens = std::min(config.attempt_burst, bucket.tokens + (now - bucket.updated) * refill);
+    bucket.updated = now;
+    if (bucket.tokens < 1) return false;
+    bucket.tokens -= 1;
+    return true;
+}
+
+std::string CredentialVerifier::cacheEntry(const std::string& username, const std::string& password, const std::string& stored)
+{
+    // The stored hash is part of the entry, so changing a password in users.json invalidates it
+    return hmacSha256(cache_key, username + '\0' + password + '\0' + stored);
+}
+
+VerifyResult CredentialVerifier::verify(const std::string& source, const std::string& username, const std::string& password, ResourcePolicy& limits)
+{
+    // A source that is out of attempts doesn't get to take a place in the queue
+    if (!hasAttempt(source))
+    {
+        rate_limited++;
+        return VerifyResult::RateLimited;
+    }
+
+    Job job;
+    job.source = &source;
+    job.username = &username;
+    job.password = &password;
+    job.limits = &limits;
+    return submit(job);
+}
+
+VerifyResult CredentialVerifier::lookup(const std::string& username, ResourcePolicy& limits)
+{
+    Job job;
+    job.username = &username;
+    job.limits = &limits;
+    return submit(job);
+}
+
+void CredentialVerifier::writeReport(std::ostream& out)
+{
+    size_t waiting;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        waiting = queue.size();
+    }
+    out << "Logins: " << hashed << " hashed, " << cache_hits << " from cache, " << rate_limited << " rate limited, "
+        << busy << " turned away busy; " << waiting << "/" << config.queue_limit << " queued for "
+        << config.workers << " worker(s)" << std::endl;
+}
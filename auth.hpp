@@ -0,0 +1,115 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <ostream>
+#include <time.h>
+#include "resources.hpp"
+
+// Stored passwords in users.json look like "pbkdf2-sha256$<iterations>$<salt hex>$<hash hex>".
+// Anything else is taken as a plaintext password from an older users file.
+#define PASSWORD_HASH_SCHEME "pbkdf2-sha256"
+#define PASSWORD_HASH_ITERATIONS 50000
+#define MAX_HASH_ITERATIONS 10000000 // entries above this are refused as malformed
+#define PASSWORD_SALT_SIZE 16
+#define PASSWORD_HASH_SIZE 32
+
+std::string hashPassword(const std::string& password, unsigned int iterations = PASSWORD_HASH_ITERATIONS);
+bool isPasswordHash(const std::string& stored);
+
+// Checks a password against a users.json entry; this is the slow part of a login
+bool verifyPassword(const std::string& password, const std::string& stored);
+
+enum class VerifyResult
+{
+    Accepted,
+    Rejected,
+    RateLimited, // too many attempts from this source
+    Busy         // verification queue is full
+};
+
+struct AuthConfig
+{
+    size_t workers = 0;          // 0 picks half the cores
+    size_t queue_limit = 64;     // logins waiting for a worker beyond this are turned away
+    double attempts_per_minute = 30; // per source, refilled continuously
+    double attempt_burst = 10;
+    int cache_ttl = 30;          // seconds a verified password is remembered, 0 disables
+};
+
+// Finds a user's stored password and resource limits in users.json; returns false for unknown users
+using AccountLookup = std::function<bool(const std::string& username, std::string& stored, ResourcePolicy& limits)>;
+
+// Runs logins on a small fixed pool so a login storm costs at most `workers` cores, whatever the
+// number of connections. The users.json lookup, the credential cache and the password hash all
+// happen on a worker; session threads only wait in verify() or lookup(), which keeps their stacks
+// shallow and their malloc caches empty for the rest of the session. Sources that keep guessing
+// run out of attempts before reaching the queue, and a user who just logged in skips the hash on
+// reconnect through a short-lived cache.
+class CredentialVerifier
+{
+private:
+    // Lives on the waiting session thread's stack until a worker marks it done
+    struct Job
+    {
+        const std::string* source = nullptr;
+        const std::string* username = nullptr;
+        const std::string* password = nullptr; // nullptr when only the limits are wanted
+        ResourcePolicy* limits = nullptr;
+        VerifyResult result = VerifyResult::Rejected;
+        bool done = false;
+        std::condition_variable finished;
+    };
+
+    struct AttemptBucket
+    {
+        double tokens;
+        double updated; // monotonic seconds
+    };
+
+    AuthConfig config;
+    AccountLookup find_account;
+    std::string cache_key; // random per process, so cached entries reveal nothing about passwords
+
+    std::mutex lock;
+    std::condition_variable work_ready;
+    std::deque<Job*> queue;
+    std::vector<std::thread> threads;
+    bool stopping = false;
+
+    std::mutex limits_lock;
+    std::unordered_map<std::string, AttemptBucket> buckets;
+    std::unordered_map<std::string, time_t> verified; // cache entry -> expiry
+
+    std::atomic<unsigned long> hashed{0}, cache_hits{0}, rate_limited{0}, busy{0};
+
+    void workerLoop();
+    VerifyResult process(const Job& job);
+    VerifyResult submit(Job& job);
+    bool hasAttempt(const std::string& source);
+    bool takeAttempt(const std::string& source);
+    std::string cacheEntry(const std::string& username, const std::string& password, const std::string& stored);
+
+public:
+    CredentialVerifier(const AuthConfig& config, AccountLookup find_account);
+    ~CredentialVerifier();
+    CredentialVerifier(const CredentialVerifier&) = delete;
+    CredentialVerifier& operator=(const CredentialVerifier&) = delete;
+
+    void start();
+
+    // Checks a login and fills `limits` when it's accepted. Unknown users are still hashed, so they
+    // take as long as a wrong password.
+    VerifyResult verify(const std::string& source, const std::string& username, const std::string& password, ResourcePolicy& limits);
+
+    // Fills `limits` for a user who resumed with a ticket; Rejected if the user is gone from users.json
+    VerifyResult lookup(const std::string& username, ResourcePolicy& limits);
+
+    void writeReport(std::ostream& out);
+};
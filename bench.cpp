@@ -0,0 +1,354 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <new>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "shell.hpp"
+#include "crypto.hpp"
+
+// Microbenchmarks for the hot paths behind every command: tokenize(), CommandShell::parseInput(),
+// encrypt_decrypt() and the fork/exec path in CommandShell::executeCommand().
+//
+//   ./bench                          run everything
+//   ./bench --filter parse           only benchmarks whose name contains "parse"
+//   ./bench --save bench.baseline    also write the results out as a baseline
+//   ./bench --compare bench.baseline show the change against a saved baseline; exits with 1
+//                                    if anything got slower than --threshold percent (10)
+//
+// Each benchmark is scaled until one batch takes --min-time seconds (0.2), then the fastest of
+// --repeat batches (5) is reported, which filters out most scheduling noise.
+
+#define DEFAULT_MIN_TIME 0.2
+#define DEFAULT_REPEAT 5
+#define DEFAULT_THRESHOLD 10.0
+
+// Every operator new in the process is counted, so each benchmark can report allocations per op.
+// Not inlined, so the compiler doesn't pair the malloc and free across the replacement.
+static std::atomic<unsigned long long> allocations{0};
+
+__attribute__((noinline)) void* operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void* block = malloc(size ? size : 1);
+    if (block == nullptr) throw std::bad_alloc();
+    return block;
+}
+
+__attribute__((noinline)) void operator delete(void* block) noexcept { free(block); }
+__attribute__((noinline)) void operator delete(void* block, size_t) noexcept { free(block); }
+
+// Keeps the compiler from dropping work whose result is never used
+template <typename T>
+static void keep(const T& value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+// Reaches the parser and the spawn path, which are private to CommandShell
+class ShellBench
+{
+public:
+    static std::vector<Pipeline> parse(CommandShell& shell, const std::string& input) { return shell.parseInput(input); }
+    static void spawn(CommandShell& shell, const Command& cmd) { shell.executeCommand(cmd, STDIN_FILENO, STDOUT_FILENO); }
+    static void captureOutput(CommandShell& shell, std::string* buffer) { shell.capture_buffer = buffer; }
+};
+
+struct Benchmark
+{
+    std::string name;
+    size_t bytes_per_op; // 0 when throughput means nothing for this benchmark
+    std::function<void(size_t iterations)> run;
+};
+
+struct Result
+{
+    double ns_per_op = 0;
+    double allocs_per_op = 0;
+    double bytes_per_second = 0;
+};
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static Result measure(const Benchmark& bench, double min_time, int repeat)
+{
+    // Grow the batch until it's long enough to time reliably
+    size_t iterations = 1;
+    while (true)
+    {
+        auto start = std::chrono::steady_clock::now();
+        bench.run(iterations);
+        double elapsed = secondsSince(start);
+        if (elapsed >= min_time) break;
+
+        double scale = elapsed > 0 ? 1.2 * min_time / elapsed : 100;
+        iterations = static_cast<size_t>(iterations * std::min(100.0, std::max(2.0, scale)));
+    }
+
+    Result best;
+    for (int i = 0; i < repeat; ++i)
+    {
+        unsigned long long allocated = allocations;
+        auto start = std::chrono::steady_clock::now();
+        bench.run(iterations);
+        double elapsed = secondsSince(start);
+        allocated = allocations - allocated;
+
+        double ns = elapsed * 1e9 / iterations;
+        if (i > 0 && ns >= best.ns_per_op) continue;
+        best.ns_per_op = ns;
+        best.allocs_per_op = static_cast<double>(allocated) / iterations;
+        best.bytes_per_second = bench.bytes_per_op ? bench.bytes_per_op * iterations / elapsed : 0;
+    }
+    return best;
+}
+
+static std::string formatRate(double bytes_per_second)
+{
+    if (bytes_per_second <= 0) return "-";
+    const char* units[] = {"B/s", "KB/s", "MB/s", "GB/s"};
+    int unit = 0;
+    while (bytes_per_second >= 1024 && unit < 3)
+    {
+        bytes_per_second /= 1024;
+        unit++;
+    }
+    char text[32];
+    snprintf(text, sizeof(text), "%.1f %s", bytes_per_second, units[unit]);
+    return text;
+}
+
+// Baseline file: one "name ns_per_op allocs_per_op bytes_per_second" line per benchmark
+static std::map<std::string, Result> loadBaseline(const std::string& path)
+{
+    std::map<std::string, Result> baseline;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream fields(line);
+        std::string name;
+        Result result;
+        if (fields >> name >> result.ns_per_op >> result.allocs_per_op >> result.bytes_per_second) baseline[name] = result;
+    }
+    return baseline;
+}
+
+static bool saveBaseline(const std::string& path, const std::vector<std::pair<std::string, Result>>& results)
+{
+    std::ofstream file(path);
+    if (!file.is_open()) return false;
+    file << "# name ns/op allocs/op bytes/s\n";
+    for (const auto& item : results)
+    {
+        file << item.first << " " << item.second.ns_per_op << " " << item.second.allocs_per_op << " "
+             << item.second.bytes_per_second << "\n";
+    }
+    return static_cast<bool>(file);
+}
+
+// Command lines of the kinds sessions actually send
+static std::string longArgumentList()
+{
+    std::string line = "rm -f";
+    char name[64];
+    for (int i = 0; i < 200; ++i)
+    {
+        snprintf(name, sizeof(name), " build/obj/module_%03d.o", i);
+        line += name;
+    }
+    return line;
+}
+
+static std::string longPipeline()
+{
+    std::string line;
+    char stage[96];
+    for (int chain = 0; chain < 8; ++chain)
+    {
+        if (chain > 0) line += " && ";
+        for (int i = 0; i < 8; ++i)
+        {
+            snprintf(stage, sizeof(stage), "%sgrep -v 'pattern %d.%d' --label=\"stage %d\"", i > 0 ? " | " : "", chain, i, i);
+            line += stage;
+        }
+        line += " > out_" + std::to_string(chain) + ".txt";
+    }
+    return line;
+}
+
+static std::vector<Benchmark> makeBenchmarks(CommandShell& shell, std::string& captured)
+{
+    std::vector<Benchmark> benches;
+
+    auto addTokenize = [&](const std::string& name, const std::string& input)
+    {
+        benches.push_back({name, input.length(), [input](size_t n)
+        {
+            for (size_t i = 0; i < n; ++i) keep(tokenize(input));
+        }});
+    };
+    addTokenize("tokenize/short", "ls -la /var/log");
+    addTokenize("tokenize/quoted", "grep -n \"error: \\\"disk full\\\"\" '/var/log/$APP/*.log' --label='a b c' \"~/notes [draft]\"");
+    addTokenize("tokenize/long-args", longArgumentList());
+
+    auto addParse = [&](const std::string& name, const std::string& input)
+    {
+        benches.push_back({name, input.length(), [&shell, input](size_t n)
+        {
+            for (size_t i = 0; i < n; ++i) keep(ShellBench::parse(shell, input));
+        }});
+    };
+    addParse("parse/simple", "ls -la /tmp");
+    addParse("parse/pipeline", "cat access.log | grep -v healthcheck | awk '{print $1}' | sort | uniq -c | sort -rn | head -20 > top.txt");
+    addParse("parse/quoted", "echo \"a && b | c\" && printf '%s\\n' \"x|y\" 'a && b' >> out.log");
+    addParse("parse/long-pipeline", longPipeline());
+
+    // The key is the session password, as in real sessions
+    auto addCipher = [&](const std::string& name, size_t size)
+    {
+        benches.push_back({name, size, [data = std::string(size, 'x')](size_t n) mutable
+        {
+            static const std::string key = "correct horse battery staple";
+            unsigned long long counter = 0;
+            for (size_t i = 0; i < n; ++i) encrypt_decrypt(&data[0], data.length(), key, counter);
+            keep(data);
+        }});
+    };
+    addCipher("cipher/keystroke", 1);
+    addCipher("cipher/frame-64B", 64);
+    addCipher("cipher/buffer-4KB", 4096);
+    addCipher("cipher/bulk-4MB", 4 * 1024 * 1024);
+
+    auto addSpawn = [&](const std::string& name, const std::vector<std::string>& args)
+    {
+        Command cmd;
+        cmd.args = args;
+        benches.push_back({name, 0, [&shell, &captured, cmd](size_t n)
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                captured.clear();
+                ShellBench::spawn(shell, cmd);
+            }
+        }});
+    };
+    addSpawn("spawn/true", {"true"});
+    addSpawn("spawn/echo", {"echo", "hello", "world"});
+
+    return benches;
+}
+
+// Option values are checked in full, so a typo gets the usage line instead of an exception
+static bool parseNonNegative(const char* text, double& value)
+{
+    char* end;
+    errno = 0;
+    value = strtod(text, &end);
+    return errno == 0 && end != text && *end == '\0' && value >= 0;
+}
+
+static bool parseCount(const char* text, int& value)
+{
+    char* end;
+    errno = 0;
+    long count = strtol(text, &end, 10);
+    if (errno != 0 || end == text || *end != '\0' || count < 1 || count > INT_MAX) return false;
+    value = static_cast<int>(count);
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string filter, save_path, compare_path;
+    double min_time = DEFAULT_MIN_TIME;
+    double threshold = DEFAULT_THRESHOLD;
+    int repeat = DEFAULT_REPEAT;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool valid = true;
+        if (arg == "--filter" && i + 1 < argc) filter = argv[++i];
+        else if (arg == "--save" && i + 1 < argc) save_path = argv[++i];
+        else if (arg == "--compare" && i + 1 < argc) compare_path = argv[++i];
+        else if (arg == "--min-time" && i + 1 < argc) valid = parseNonNegative(argv[++i], min_time);
+        else if (arg == "--repeat" && i + 1 < argc) valid = parseCount(argv[++i], repeat);
+        else if (arg == "--threshold" && i + 1 < argc) valid = parseNonNegative(argv[++i], threshold);
+        else valid = false;
+
+        if (!valid)
+        {
+            std::cerr << "Usage: " << argv[0] << " [--filter text] [--save file] [--compare file] [--min-time s] [--repeat n] [--threshold %]" << std::endl;
+            return 2;
+        }
+    }
+    min_time = std::max(0.001, min_time);
+
+#ifndef __OPTIMIZE__
+    std::cerr << "Warning: bench was built without optimization, numbers won't match a release build" << std::endl;
+#endif
+
+    std::map<std::string, Result> baseline;
+    if (!compare_path.empty())
+    {
+        baseline = loadBaseline(compare_path);
+        if (baseline.empty()) std::cerr << "No baseline results in " << compare_path << std::endl;
+    }
+
+    // Output that commands print is collected instead of being sent to a client
+    std::string captured;
+    CommandShell shell(-1, "bench", "bench", ResourcePolicy());
+    ShellBench::captureOutput(shell, &captured);
+
+    printf("%-22s %12s %12s %10s %12s\n", "benchmark", "ns/op", "bytes/s", "allocs/op", "vs baseline");
+
+    std::vector<std::pair<std::string, Result>> results;
+    bool regressed = false;
+    for (const Benchmark& bench : makeBenchmarks(shell, captured))
+    {
+        if (!filter.empty() && bench.name.find(filter) == std::string::npos) continue;
+
+        Result result = measure(bench, min_time, repeat);
+        results.emplace_back(bench.name, result);
+
+        std::string change = "";
+        auto old = baseline.find(bench.name);
+        if (old != baseline.end() && old->second.ns_per_op > 0)
+        {
+            double percent = 100.0 * (result.ns_per_op - old->second.ns_per_op) / old->second.ns_per_op;
+            char text[32];
+            snprintf(text, sizeof(text), "%+.1f%%%s", percent, percent > threshold ? " SLOWER" : "");
+            change = text;
+            if (percent > threshold) regressed = true;
+        }
+
+        printf("%-22s %12.1f %12s %10.2f %12s\n", bench.name.c_str(), result.ns_per_op,
+               formatRate(result.bytes_per_second).c_str(), result.allocs_per_op, change.c_str());
+        fflush(stdout);
+    }
+
+    if (!save_path.empty())
+    {
+        if (!saveBaseline(save_path, results))
+        {
+            std::cerr << "Could not write " << save_path << std::endl;
+            return 2;
+        }
+        std::cout << "Saved " << results.size() << " result(s) to " << save_path << std::endl;
+    }
+    return regressed ? 1 : 0;
+}
@@ -6,26 +6,533 @@
 #include <termios.h>
 #include <fcntl.h>
 #include <string.h>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <functional>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <errno.h>
+#include "crypto.hpp"
+#include "protocol.hpp"
+#include "fanout.hpp"
+#include "watch.hpp"
+#include "latency.hpp"
 
+#define SERVER_ADDRESS "127.0.0.1"
 #define PORT 8090
 #define BUFFER_SIZE 4096
+#define COMPLETION_TIMEOUT_MS 2000
+#define TRACE_ESCAPE 0x1d // Ctrl-], followed by 'l' prints the latency histograms
 
-void encrypt_decrypt(char* data, size_t len, const std::string& key, unsigned long long& counter)
+// Asks the server to complete the text before the cursor; fills in where the completed word starts
+using Completer = std::function<bool(const std::string& before_cursor, size_t& word_start, std::vector<std::string>& matches)>;
+
+// Line editor for non-interactive mode: cursor movement, kill commands, command history and Tab completion
+class LineEditor
 {
-    for (size_t i = 0; i < len; i++) 
+private:
+    std::vector<std::string> history;
+    std::string line;
+    size_t cursor = 0;
+    size_t history_index = 0;
+    std::string saved_line; // line being typed before browsing history
+    std::string prompt;     // last prompt from the server, redrawn after listing completions
+    Completer completer;
+
+    void moveCursor(size_t target)
+    {
+        char seq[32];
+        if (target < cursor) write(STDOUT_FILENO, seq, snprintf(seq, sizeof(seq), "\x1b[%zuD", cursor - target));
+        else if (target > cursor) write(STDOUT_FILENO, seq, snprintf(seq, sizeof(seq), "\x1b[%zuC", target - cursor));
+        cursor = target;
+    }
+
+    // Rewrites everything from `from` to the end of the line and puts the cursor at `target`
+    void redrawFrom(size_t from, size_t target)
+    {
+        moveCursor(from);
+        write(STDOUT_FILENO, line.c_str() + from, line.length() - from);
+        write(STDOUT_FILENO, "\x1b[K", 3);
+        cursor = line.length();
+        moveCursor(target);
+    }
+
+    void replaceLine(const std::string& text)
+    {
+        moveCursor(0);
+        line = text;
+        redrawFrom(0, line.length());
+    }
+
+    void erase(size_t from, size_t to)
+    {
+        if (from >= to) return;
+        line.erase(from, to - from);
+        redrawFrom(from, from);
+    }
+
+    void historyStep(int direction)
+    {
+        if (direction < 0 && history_index == 0) return;
+        if (direction > 0 && history_index >= history.size()) return;
+
+        if (history_index == history.size()) saved_line = line;
+        history_index += direction;
+        replaceLine(history_index == history.size() ? saved_line : history[history_index]);
+    }
+
+    void insert(const std::string& text)
+    {
+        line.insert(cursor, text);
+        if (cursor + text.length() == line.length()) 
+        {
+            write(STDOUT_FILENO, text.c_str(), text.length());
+            cursor = line.length();
+        }
+        else redrawFrom(cursor, cursor + text.length());
+    }
+
+    // Prints candidates in columns below the line, then redraws the prompt and the line
+    void listCandidates(const std::vector<std::string>& matches, size_t name_offset)
+    {
+        struct winsize ws;
+        size_t columns = ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 ? ws.ws_col : 80;
+        size_t width = 0;
+        for (const auto& match : matches) width = std::max(width, match.length() - name_offset + 2);
+        size_t per_row = std::max<size_t>(1, columns / width);
+
+        std::string text = "\n";
+        for (size_t i = 0; i < matches.size(); ++i) 
+        {
+            std::string name = matches[i].substr(name_offset);
+            text += name;
+            if ((i + 1) % per_row == 0 || i + 1 == matches.size()) text += "\n";
+            else text.append(width - name.length(), ' ');
+        }
+        if (matches.size() >= MAX_COMPLETIONS) text += "(more)\n";
+
+        size_t target = cursor;
+        moveCursor(line.length());
+        write(STDOUT_FILENO, text.c_str(), text.length());
+        write(STDOUT_FILENO, prompt.c_str(), prompt.length());
+        write(STDOUT_FILENO, line.c_str(), line.length());
+        cursor = line.length();
+        moveCursor(target);
+    }
+
+    void complete()
+    {
+        size_t start;
+        std::vector<std::string> matches;
+        if (!completer || !completer(line.substr(0, cursor), start, matches) || matches.empty() || start > cursor) 
+        {
+            write(STDOUT_FILENO, "\a", 1);
+            return;
+        }
+
+        std::string word = line.substr(start, cursor - start);
+        std::string common = matches[0];
+        for (const auto& match : matches) 
+        {
+            size_t n = 0;
+            while (n < common.length() && n < match.length() && common[n] == match[n]) n++;
+            common.resize(n);
+        }
+        if (common.compare(0, word.length(), word) != 0) return;
+
+        if (common.length() > word.length()) insert(common.substr(word.length()));
+        if (matches.size() == 1) 
+        {
+            if (common.back() != '/') insert(" ");
+        }
+        else if (common.length() == word.length()) 
+        {
+            size_t slash = word.rfind('/');
+            listCandidates(matches, slash == std::string::npos ? 0 : slash + 1);
+        }
+    }
+
+    void handleEscape()
     {
-        data[i] = data[i] ^ key[(counter++) % key.length()];
+        char c;
+        if (read(STDIN_FILENO, &c, 1) <= 0 || (c != '[' && c != 'O')) return;
+        if (read(STDIN_FILENO, &c, 1) <= 0) return;
+
+        // Sequences like ESC [ 3 ~ carry a numeric parameter
+        int param = 0;
+        while (c >= '0' && c <= '9') 
+        {
+            param = param * 10 + (c - '0');
+            if (read(STDIN_FILENO, &c, 1) <= 0) return;
+        }
+
+        if (c == 'D') { if (cursor > 0) moveCursor(cursor - 1); }
+        else if (c == 'C') { if (cursor < line.length()) moveCursor(cursor + 1); }
+        else if (c == 'A') historyStep(-1);
+        else if (c == 'B') historyStep(1);
+        else if (c == 'H' || (c == '~' && (param == 1 || param == 7))) moveCursor(0);
+        else if (c == 'F' || (c == '~' && (param == 4 || param == 8))) moveCursor(line.length());
+        else if (c == '~' && param == 3) erase(cursor, cursor + (cursor < line.length() ? 1 : 0));
     }
+
+public:
+    static const size_t MAX_HISTORY = 500;
+
+    void setPrompt(const std::string& text) { prompt = text; }
+    void setCompleter(Completer handler) { completer = std::move(handler); }
+
+    // Reads keys until Enter and returns the edited line
+    std::string readLine()
+    {
+        line.clear();
+        cursor = 0;
+        history_index = history.size();
+
+        char c;
+        while (read(STDIN_FILENO, &c, 1) > 0) 
+        {
+            if (c == '\r') break;
+
+            if (c == 127 || c == '\b') { if (cursor > 0) { moveCursor(cursor - 1); erase(cursor, cursor + 1); } }
+            else if (c == '\x1b') handleEscape();
+            else if (c == 1) moveCursor(0);                    // Ctrl-A
+            else if (c == 5) moveCursor(line.length());        // Ctrl-E
+            else if (c == 2) { if (cursor > 0) moveCursor(cursor - 1); }             // Ctrl-B
+            else if (c == 6) { if (cursor < line.length()) moveCursor(cursor + 1); } // Ctrl-F
+            else if (c == 11) erase(cursor, line.length());   // Ctrl-K
+            else if (c == 16) historyStep(-1);                 // Ctrl-P
+            else if (c == 14) historyStep(1);                  // Ctrl-N
+            else if (c == 21)                                  // Ctrl-U
+            {
+                size_t end = cursor;
+                moveCursor(0);
+                erase(0, end);
+            }
+            else if (c == 23)                                  // Ctrl-W
+            {
+                size_t start = cursor;
+                while (start > 0 && line[start - 1] == ' ') start--;
+                while (start > 0 && line[start - 1] != ' ') start--;
+                size_t end = cursor;
+                moveCursor(start);
+                erase(start, end);
+            }
+            else if (c == 3)                                   // Ctrl-C discards the line
+            {
+                moveCursor(line.length());
+                write(STDOUT_FILENO, "^C", 2);
+                line.clear();
+                break;
+            }
+            else if (c == '\t') complete();
+            else if (static_cast<unsigned char>(c) >= 32) insert(std::string(1, c));
+        }
+
+        if (!line.empty() && (history.empty() || history.back() != line)) 
+        {
+            history.push_back(line);
+            if (history.size() > MAX_HISTORY) history.erase(history.begin());
+        }
+        return line;
+    }
+};
+
+// Mosh-style local echo for interactive mode. Printable keystrokes are drawn underlined before the
+// server has echoed them; when the echo arrives the predicted cells are overwritten with the real
+// output. Predictions are only shown once the link is slow enough to matter and an earlier keystroke
+// on the same line has been confirmed, so prompts with echo disabled (passwords) never leak input.
+class PredictiveEcho
+{
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr double SHOW_THRESHOLD_MS = 20.0;
+    static constexpr double MIN_TIMEOUT_MS = 500.0;
+
+    struct Prediction
+    {
+        char c;
+        Clock::time_point sent;
+    };
+
+    bool enabled;
+    std::deque<Prediction> pending;
+    size_t displayed = 0;              // trailing pending entries currently drawn on screen
+    bool confirmed_on_line = false;    // an echo has been seen since the last Enter
+    bool cursor_moved = false;         // cursor may not be at end of line, so drawing is unsafe
+    bool alt_screen = false;           // full-screen applications do their own rendering
+    double srtt_ms = 0.0;
+
+    void eraseDisplayed()
+    {
+        if (displayed == 0) return;
+        char seq[32];
+        write(STDOUT_FILENO, seq, snprintf(seq, sizeof(seq), "\x1b[%zuD\x1b[K", displayed));
+        displayed = 0;
+    }
+
+    // Draws the pending entries that are not yet on screen
+    void drawPending()
+    {
+        std::string text = "\x1b[4m";
+        for (size_t i = displayed; i < pending.size(); ++i) text += pending[i].c;
+        text += "\x1b[24m";
+        write(STDOUT_FILENO, text.c_str(), text.length());
+        displayed = pending.size();
+    }
+
+    bool canShow() const
+    {
+        return confirmed_on_line && !cursor_moved && !alt_screen && srtt_ms >= SHOW_THRESHOLD_MS;
+    }
+
+    void trackScreenMode(const char* data, size_t len)
+    {
+        std::string chunk(data, len);
+        if (chunk.find("\x1b[?1049h") != std::string::npos || chunk.find("\x1b[?47h") != std::string::npos) alt_screen = true;
+        if (chunk.find("\x1b[?1049l") != std::string::npos || chunk.find("\x1b[?47l") != std::string::npos) alt_screen = false;
+    }
+
+public:
+    explicit PredictiveEcho(bool enable) : enabled(enable) {}
+
+    // Called for every keystroke before it is sent to the server
+    void keystroke(char c)
+    {
+        if (!enabled) return;
+
+        if (c < 32 || c == 127) 
+        {
+            // Control keys are not predicted; Enter starts a new line with fresh confidence
+            if (c == '\r') 
+            {
+                confirmed_on_line = false;
+                cursor_moved = false;
+            }
+            else if (c != '\t') cursor_moved = true;
+            pending.clear();
+            eraseDisplayed();
+            return;
+        }
+        if (static_cast<unsigned char>(c) >= 128) return;
+
+        // Either every pending keystroke is on screen or none is, so the cursor column stays known
+        pending.push_back({c, Clock::now()});
+        if (canShow() && displayed + 1 == pending.size()) drawPending();
+    }
+
+    // Writes server output to the terminal, reconciling it with any predictions on screen
+    void serverOutput(const char* data, size_t len)
+    {
+        if (!enabled) 
+        {
+            write(STDOUT_FILENO, data, len);
+            return;
+        }
+
+        size_t matched = 0;
+        while (matched < len && matched < pending.size() && data[matched] == pending[matched].c) matched++;
+        bool mispredicted = matched < len && matched < pending.size();
+
+        // Step back over predicted cells so the real echo overwrites them
+        if (displayed > 0) 
+        {
+            char seq[32];
+            write(STDOUT_FILENO, seq, snprintf(seq, sizeof(seq), mispredicted ? "\x1b[%zuD\x1b[K" : "\x1b[%zuD", displayed));
+            displayed = 0;
+        }
+
+        if (matched > 0) 
+        {
+            double sample = std::chrono::duration<double, std::milli>(Clock::now() - pending[matched - 1].sent).count();
+            srtt_ms = srtt_ms == 0.0 ? sample : 0.875 * srtt_ms + 0.125 * sample;
+            confirmed_on_line = true;
+        }
+
+        write(STDOUT_FILENO, data, len);
+        trackScreenMode(data, len);
+
+        if (mispredicted) 
+        {
+            pending.clear();
+            return;
+        }
+
+        pending.erase(pending.begin(), pending.begin() + matched);
+        if (!pending.empty() && canShow()) drawPending();
+    }
+
+    // Milliseconds until the oldest prediction expires, or -1 if nothing is pending
+    int timeoutMs() const
+    {
+        if (pending.empty()) return -1;
+        double limit = std::max(MIN_TIMEOUT_MS, 4 * srtt_ms);
+        double age = std::chrono::duration<double, std::milli>(Clock::now() - pending.front().sent).count();
+        return std::max(0, static_cast<int>(limit - age));
+    }
+
+    // Drops predictions the server never echoed, e.g. after echo was switched off
+    void expire()
+    {
+        if (pending.empty() || timeoutMs() > 0) return;
+        eraseDisplayed();
+        pending.clear();
+        confirmed_on_line = false;
+    }
+};
+
+// Resumption ticket kept between runs so reconnecting doesn't need the password again
+struct StoredTicket
+{
+    std::string username;
+    std::string ticket;
+    std::string key;
+    time_t expiry = 0;
+};
+
+static std::string ticketPath()
+{
+    const char* home = getenv("HOME");
+    return std::string(home ? home : ".") + "/.myssh_ticket";
+}
+
+// File format: one line "<server> <username> <ticket> <key> <expiry>"
+bool loadTicket(const std::string& server_id, StoredTicket& ticket)
+{
+    std::ifstream file(ticketPath());
+    std::string server;
+    if (!(file >> server >> ticket.username >> ticket.ticket >> ticket.key >> ticket.expiry)) return false;
+    return server == server_id;
+}
+
+void saveTicket(const std::string& server_id, const StoredTicket& ticket)
+{
+    int fd = open(ticketPath().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) return;
+    std::string line = server_id + " " + ticket.username + " " + ticket.ticket + " " + ticket.key + " " + std::to_string(ticket.expiry) + "\n";
+    write(fd, line.c_str(), line.length());
+    close(fd);
+}
+
+// Reads the plaintext handshake reply up to its empty line; bytes after it belong to the session stream
+bool readReplyHeader(int sock, std::string& reply, std::string& leftover)
+{
+    std::string data = leftover;
+    char buffer[BUFFER_SIZE];
+    size_t end;
+
+    while ((end = data.find("\n\n")) == std::string::npos) 
+    {
+        int bytes_read = read(sock, buffer, sizeof(buffer));
+        if (bytes_read <= 0) return false;
+        data.append(buffer, bytes_read);
+    }
+    reply = data.substr(0, end + 1);
+    leftover = data.substr(end + 2);
+    return true;
+}
+
+// Memory benchmark: opens `count` command sessions and leaves them idle until Enter is pressed,
+// so the server's memory report (kill -USR1) shows the per-session cost
+int holdIdleSessions(int count)
+{
+    struct rlimit files;
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0) 
+    {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+
+    std::string username, password;
+    std::cout << "Username: " << std::flush;
+    std::getline(std::cin, username);
+    std::cout << "Password: " << std::flush;
+    std::getline(std::cin, password);
+    std::string hello = std::string(PROTOCOL_HELLO) + " command\nuser " + username + "\npass " + password + "\n\n";
+
+    struct sockaddr_in serv_addr = {};
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_port = htons(PORT);
+    inet_pton(AF_INET, SERVER_ADDRESS, &serv_addr.sin_addr);
+
+    std::vector<int> sessions;
+    auto started = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i) 
+    {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        std::string reply, leftover;
+        if (sock < 0 || connect(sock, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) < 0 || 
+            send(sock, hello.c_str(), hello.length(), 0) < 0 || !readReplyHeader(sock, reply, leftover) ||
+            reply.compare(0, strlen(AUTH_SUCCESS), AUTH_SUCCESS) != 0) 
+        {
+            std::cerr << "Session " << i + 1 << " failed: " << strerror(errno) << std::endl;
+            if (sock >= 0) close(sock);
+            break;
+        }
+        sessions.push_back(sock);
+        if ((i + 1) % 1000 == 0) std::cout << i + 1 << " sessions open" << std::endl;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    std::cout << sessions.size() << " idle sessions open after " << seconds << "s, press Enter to close them" << std::endl;
+    std::string line;
+    std::getline(std::cin, line);
+
+    for (int sock : sessions) close(sock);
+    return sessions.size() == static_cast<size_t>(count) ? 0 : 1;
 }
 
 int main(int argc, char* argv[]) 
 {
     bool interactive_mode = false;
+    bool predict = true;
+    bool use_tickets = true;
+    std::string host_file;
+    double watch_interval = 0;
+    int idle_sessions = 0;
+    bool trace_latency = false;
+    FanoutOptions fanout;
     for (int i = 1; i < argc; ++i) {
-        if (std::string(argv[i]) == "--interactive-mode") {
-            interactive_mode = true;
-            break;
+        std::string arg = argv[i];
+        if (arg == "--interactive-mode") interactive_mode = true;
+        else if (arg == "--no-predict") predict = false;
+        else if (arg == "--no-ticket") use_tickets = false;
+        else if (arg == "--fanout" && i + 1 < argc) host_file = argv[++i];
+        else if (arg == "--command" && i + 1 < argc) fanout.command = argv[++i];
+        else if (arg == "--parallel" && i + 1 < argc) fanout.parallel = std::max(1, atoi(argv[++i]));
+        else if (arg == "--timeout" && i + 1 < argc) fanout.timeout = std::max(1, atoi(argv[++i]));
+        else if (arg == "--watch" && i + 1 < argc) watch_interval = atof(argv[++i]);
+        else if (arg == "--idle-sessions" && i + 1 < argc) idle_sessions = std::max(1, atoi(argv[++i]));
+        else if (arg == "--trace-latency") trace_latency = true;
+    }
+
+    if (idle_sessions > 0) return holdIdleSessions(idle_sessions);
+
+    if (watch_interval > 0 && fanout.command.empty()) 
+    {
+        std::cerr << "Usage: client --watch <seconds> --command <command>" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // Fan-out: run one command on every host in the list instead of opening a session
+    if (!host_file.empty()) 
+    {
+        fanout.hosts = readHostList(host_file);
+        if (fanout.hosts.empty() || fanout.command.empty()) 
+        {
+            std::cerr << "Usage: client --fanout <host file> --command <command> [--parallel N] [--timeout seconds]" << std::endl;
+            exit(EXIT_FAILURE);
         }
+        fanout.default_port = PORT;
+        std::cout << "Username: " << std::flush;
+        std::getline(std::cin, fanout.username);
+        std::cout << "Password: " << std::flush;
+        std::getline(std::cin, fanout.password);
+        return runFanout(fanout);
     }
 
     int sock = 0;
@@ -41,7 +548,7 @@ int main(int argc, char* argv[])
     serv_addr.sin_family = AF_INET;
     serv_addr.sin_port = htons(PORT);
     
-    if (inet_pton(AF_INET, "127.0.0.1", &serv_addr.sin_addr) <= 0) 
+    if (inet_pton(AF_INET, SERVER_ADDRESS, &serv_addr.sin_addr) <= 0) 
     {
         perror("Invalid address\n");
         exit(EXIT_FAILURE);
@@ -53,49 +560,80 @@ int main(int argc, char* argv[])
         exit(EXIT_FAILURE);
     }
 
-    std::string username, password;
+    std::string server_id = std::string(SERVER_ADDRESS) + ":" + std::to_string(PORT);
+    std::string username, password, session_key, leftover;
     unsigned long long encrypt_counter = 0;
     unsigned long long decrypt_counter = 0;
-    
-    int bytes_read = read(sock, buffer, BUFFER_SIZE);
-    if (bytes_read <= 0) 
-    {
-        perror("Connection closed by server");
-        close(sock);
-        exit(EXIT_FAILURE);
-    }
-    std::cout << buffer << std::flush;
-    
-    std::getline(std::cin, username);
-    send(sock, username.c_str(), username.length(), 0);
-    
-    bytes_read = read(sock, buffer, BUFFER_SIZE);
-    if (bytes_read <= 0)
-    {
-        perror("Connection closed by server");
-        close(sock);
-        exit(EXIT_FAILURE);
-    }
-    std::cout << buffer << std::flush;
-    
-    std::getline(std::cin, password);
-    send(sock, password.c_str(), password.length(), 0);
-    
-    bytes_read = read(sock, buffer, BUFFER_SIZE);
-    if (bytes_read <= 0) 
-    {
-        perror("Authentication failed");
-        close(sock);
-        exit(EXIT_FAILURE);
-    }
-    
-    if (strncmp(buffer, "Authentication failed\n", 22) == 0)
+
+    StoredTicket stored;
+    bool use_ticket = use_tickets && loadTicket(server_id, stored) && stored.expiry > time(nullptr);
+
+    // The whole login is one message and one reply; a rejected ticket costs one extra round trip
+    while (true) 
     {
-        std::cout << "Authentication failed\n";
-        close(sock);
-        exit(EXIT_FAILURE);
+        std::string hello = std::string(PROTOCOL_HELLO);
+        if (watch_interval > 0) hello += " watch\nexec " + fanout.command + "\ninterval " + std::to_string(watch_interval) + "\n";
+        else hello += interactive_mode ? " interactive\n" : " command\n";
+        if (interactive_mode && trace_latency) hello += "trace on\n";
+
+        if (use_ticket) hello += "user " + stored.username + "\nticket " + stored.ticket + "\n\n";
+        else 
+        {
+            std::cout << "Username: " << std::flush;
+            std::getline(std::cin, username);
+            std::cout << "Password: " << std::flush;
+            std::getline(std::cin, password);
+            hello += "user " + username + "\npass " + password + "\n\n";
+        }
+        send(sock, hello.c_str(), hello.length(), 0);
+
+        std::string reply;
+        if (!readReplyHeader(sock, reply, leftover)) 
+        {
+            perror("Connection closed by server");
+            close(sock);
+            exit(EXIT_FAILURE);
+        }
+
+        if (reply.compare(0, strlen(TICKET_REJECTED), TICKET_REJECTED) == 0) 
+        {
+            use_ticket = false;
+            continue;
+        }
+
+        if (reply.compare(0, strlen(AUTH_SUCCESS), AUTH_SUCCESS) != 0) 
+        {
+            if (reply.compare(0, strlen(AUTH_THROTTLED), AUTH_THROTTLED) == 0) std::cout << "Too many login attempts, try again later\n";
+            else if (reply.compare(0, strlen(SERVICE_UNAVAILABLE), SERVICE_UNAVAILABLE) == 0) std::cout << "Service unavailable, no server is accepting sessions\n";
+            else std::cout << "Authentication failed\n";
+            close(sock);
+            exit(EXIT_FAILURE);
+        }
+
+        if (use_ticket) session_key = stored.key;
+        else 
+        {
+            session_key = password;
+
+            std::istringstream lines(reply);
+            std::string line, tag, nonce_hex, nonce;
+            while (std::getline(lines, line)) 
+            {
+                std::istringstream fields(line);
+                StoredTicket issued;
+                if (fields >> tag >> issued.ticket >> nonce_hex >> issued.expiry && tag == "Ticket" && fromHex(nonce_hex, nonce)) 
+                {
+                    issued.username = username;
+                    issued.key = deriveResumeKey(password, nonce);
+                    if (use_tickets) saveTicket(server_id, issued);
+                }
+            }
+        }
+        break;
     }
 
+    if (watch_interval > 0) return watchCommand(sock, session_key, leftover, fanout.command, watch_interval);
+
     struct termios orig_termios;
     tcgetattr(STDIN_FILENO, &orig_termios);
 
@@ -108,6 +646,112 @@ int main(int argc, char* argv[])
 
     fd_set readfds;
     char input_char;
+    LineEditor editor;
+    PredictiveEcho echo(interactive_mode && predict);
+
+    FrameReader frames;
+    std::string completion_reply;
+    bool completion_received = false;
+
+    // Latency tracing: one probe is in flight at a time, riding on a real keystroke
+    bool tracing = interactive_mode && trace_latency;
+    LatencyTrace latency;
+    ProbeTimer probe_timer;
+    uint64_t probe_id = 0;
+    uint64_t probe_sent_at = 0;
+    bool probe_outstanding = false;
+    bool trace_escape = false;
+    // Results ride along with the next keystroke; sent alone they'd hold that keystroke up on Nagle
+    std::string queued_results;
+
+    auto sendFrameToServer = [&](char type, const std::string& payload) 
+    {
+        std::string frame;
+        frame.swap(queued_results);
+        appendFrame(frame, type, payload.data(), payload.length());
+        encrypt_decrypt(&frame[0], frame.length(), session_key, encrypt_counter);
+        send(sock, frame.c_str(), frame.length(), 0);
+    };
+
+    // Interactive sessions are a raw terminal stream unless traced; command sessions arrive as frames
+    auto deliver = [&](const char* data, size_t len) 
+    {
+        if (interactive_mode && !tracing) 
+        {
+            echo.serverOutput(data, len);
+            return true;
+        }
+
+        frames.feed(data, len);
+        char type;
+        std::string payload;
+        bool error;
+        while (frames.next(type, payload, error)) 
+        {
+            if (tracing) 
+            {
+                ProbeTimes times;
+                if (type == FRAME_OUTPUT) echo.serverOutput(payload.data(), payload.length());
+                else if (type == FRAME_PROBE && decodeProbeReply(payload, times) && probe_outstanding && times.id == probe_id) 
+                {
+                    uint64_t samples[LEG_COUNT];
+                    probe_timer.complete(times, monotonicMicros(), samples);
+                    latency.add(samples);
+                    std::string result = encodeProbeResult(times.id, samples);
+                    appendFrame(queued_results, FRAME_PROBE_RESULT, result.data(), result.length());
+                    probe_outstanding = false;
+                }
+                continue;
+            }
+
+            if (type == FRAME_OUTPUT || type == FRAME_PROMPT) write(STDOUT_FILENO, payload.data(), payload.length());
+            if (type == FRAME_PROMPT) editor.setPrompt(payload);
+            if (type == FRAME_COMPLETIONS) 
+            {
+                completion_reply = std::move(payload);
+                completion_received = true;
+            }
+        }
+        return !error;
+    };
+
+    // Tab sends the text before the cursor and waits briefly for the server's candidates
+    editor.setCompleter([&](const std::string& before_cursor, size_t& word_start, std::vector<std::string>& matches) 
+    {
+        sendFrameToServer(FRAME_COMPLETE, before_cursor);
+
+        completion_received = false;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(COMPLETION_TIMEOUT_MS);
+        while (!completion_received) 
+        {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+            if (remaining <= 0) return false;
+
+            fd_set sockfds;
+            FD_ZERO(&sockfds);
+            FD_SET(sock, &sockfds);
+            struct timeval wait = {static_cast<time_t>(remaining / 1000), static_cast<suseconds_t>((remaining % 1000) * 1000)};
+            if (select(sock + 1, &sockfds, NULL, NULL, &wait) <= 0) return false;
+
+            int bytes_read = read(sock, buffer, BUFFER_SIZE);
+            if (bytes_read <= 0) return false;
+            encrypt_decrypt(buffer, bytes_read, session_key, decrypt_counter);
+            if (!deliver(buffer, bytes_read)) return false;
+        }
+
+        std::istringstream reply(completion_reply);
+        std::string item;
+        if (!std::getline(reply, item)) return false;
+        word_start = strtoul(item.c_str(), nullptr, 10);
+        while (std::getline(reply, item)) matches.push_back(item);
+        return true;
+    });
+
+    if (!leftover.empty()) 
+    {
+        encrypt_decrypt(&leftover[0], leftover.length(), session_key, decrypt_counter);
+        deliver(leftover.data(), leftover.length());
+    }
 
     while (true) 
     {
@@ -115,7 +759,21 @@ int main(int argc, char* argv[])
         FD_SET(STDIN_FILENO, &readfds);
         FD_SET(sock, &readfds);
 
-        select(sock + 1, &readfds, NULL, NULL, NULL);
+        struct timeval tv;
+        struct timeval* timeout = NULL;
+        int timeout_ms = echo.timeoutMs();
+        if (timeout_ms >= 0) 
+        {
+            tv.tv_sec = timeout_ms / 1000;
+            tv.tv_usec = (timeout_ms % 1000) * 1000;
+            timeout = &tv;
+        }
+
+        if (select(sock + 1, &readfds, NULL, NULL, timeout) == 0) 
+        {
+            echo.expire();
+            continue;
+        }
 
         if (FD_ISSET(STDIN_FILENO, &readfds)) 
         {
@@ -123,68 +781,49 @@ int main(int argc, char* argv[])
             {
                 if (read(STDIN_FILENO, &input_char, 1) > 0)
                 {
-                    encrypt_decrypt(&input_char, 1, password, encrypt_counter);
-                    send(sock, &input_char, 1, 0);
-                }
-            }
-            else 
-            {
-                std::string command;
-                size_t cursor_pos = 0; 
-                char c;
-                while (read(STDIN_FILENO, &c, 1) > 0) 
-                {
-                    if (c == '\r') break;
-
-                    if (c == 127) { // Backspace
-                        if (cursor_pos > 0) {
-                            command.erase(cursor_pos - 1, 1);
-                            cursor_pos--;   
-                            write(STDOUT_FILENO, "\b \b", 3);
+                    // Ctrl-] l prints the histograms; Ctrl-] Ctrl-] sends a literal Ctrl-]
+                    if (tracing && (trace_escape || input_char == TRACE_ESCAPE)) 
+                    {
+                        bool was_escape = trace_escape;
+                        trace_escape = !trace_escape && input_char == TRACE_ESCAPE;
+                        if (!was_escape) continue;
+                        if (input_char == 'l') 
+                        {
+                            std::string report = "\r\nKeystroke latency:\r\n" + latency.format(true, "\r\n");
+                            write(STDOUT_FILENO, report.c_str(), report.length());
+                            continue;
                         }
                     }
-                    else if (c == '\x1b') { // Escape sequence start
-                        char seq[2];
-                        if (read(STDIN_FILENO, seq, 2) == 2) {  // Read next 2 bytes
-                            if (seq[0] == '[') {
-                                if (seq[1] == 'D') {  // Left arrow
-                                    if (cursor_pos > 0) {
-                                        cursor_pos--;
-                                        write(STDOUT_FILENO, "\b", 1);
-                                    }
-                                }
-                                else if (seq[1] == 'C') {  // Right arrow
-                                    if (cursor_pos < command.length()) {
-                                        cursor_pos++;
-                                        write(STDOUT_FILENO, "\x1b[C", 3);
-                                    }
-                                }
-                            }
-                        }
+
+                    echo.keystroke(input_char);
+                    if (!tracing) 
+                    {
+                        encrypt_decrypt(&input_char, 1, session_key, encrypt_counter);
+                        send(sock, &input_char, 1, 0);
                     }
-                    else {
-                        command.insert(cursor_pos, 1, c);
-                        cursor_pos++;   
-                        write(STDOUT_FILENO, &c, 1);
-                        if (cursor_pos < command.length()) {
-                            // Write rest of string
-                            write(STDOUT_FILENO, command.c_str() + cursor_pos, command.length() - cursor_pos);
-                            // Move cursor back to insertion point
-                            for (size_t i = 0; i < command.length() - cursor_pos; i++) {
-                                write(STDOUT_FILENO, "\b", 1);
-                            }
+                    else 
+                    {
+                        // A probe the server never answered (nothing echoed) is given up on after a while
+                        uint64_t now = monotonicMicros();
+                        if (probe_outstanding && now - probe_sent_at > 2 * PROBE_TIMEOUT_US) probe_outstanding = false;
+
+                        if (probe_outstanding) sendFrameToServer(FRAME_INPUT, std::string(1, input_char));
+                        else 
+                        {
+                            probe_outstanding = true;
+                            probe_sent_at = now;
+                            sendFrameToServer(FRAME_PROBE, encodeProbeRequest(++probe_id, now, &input_char, 1));
                         }
                     }
                 }
-                c = '\n';
-                write(STDOUT_FILENO, &c, 1);
-
-                // Encrypt and send the whole command at once
-                char* encrypted_cmd = new char[command.length()];
-                memcpy(encrypted_cmd, command.c_str(), command.length());
-                encrypt_decrypt(encrypted_cmd, command.length(), password, encrypt_counter);
-                send(sock, encrypted_cmd, command.length(), 0);
-                delete[] encrypted_cmd;
+            }
+            else 
+            {
+                std::string command = editor.readLine();
+                write(STDOUT_FILENO, "\n", 1);
+
+                // Encrypt and send the whole command as one frame
+                sendFrameToServer(FRAME_INPUT, command);
             }
         }
 
@@ -193,12 +832,13 @@ int main(int argc, char* argv[])
             int bytes_read = read(sock, buffer, BUFFER_SIZE);
             if (bytes_read <= 0) break;
 
-            encrypt_decrypt(buffer, bytes_read, password, decrypt_counter);
-            write(STDOUT_FILENO, buffer, bytes_read);
+            encrypt_decrypt(buffer, bytes_read, session_key, decrypt_counter);
+            if (!deliver(buffer, bytes_read)) break;
         }
     }
 
     tcsetattr(STDIN_FILENO, TCSANOW, &orig_termios);
     close(sock);
+    if (tracing) std::cout << "\nKeystroke latency:\n" << latency.format(false, "\n");
     return 0;
 }
\ No newline at end of file
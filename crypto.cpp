@@ -0,0 +1,266 @@
+#include "crypto.hpp"
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+void encrypt_decrypt(char* data, size_t len, const std::string& key, unsigned long long& counter) 
+{
+    for (size_t i = 0; i < len; i++) 
+    {
+        data[i] = data[i] ^ key[(counter++) % key.length()];
+    }
+}
+
+static const uint32_t SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+static void sha256Block(uint32_t state[8], const unsigned char* block)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) 
+    {
+        w[i] = (uint32_t(block[i*4]) << 24) | (uint32_t(block[i*4+1]) << 16) | (uint32_t(block[i*4+2]) << 8) | block[i*4+3];
+    }
+    for (int i = 16; i < 64; i++) 
+    {
+        uint32_t s0 = rotr(w[i-15], 7) ^ rotr(w[i-15], 18) ^ (w[i-15] >> 3);
+        uint32_t s1 = rotr(w[i-2], 17) ^ rotr(w[i-2], 19) ^ (w[i-2] >> 10);
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) 
+    {
+        uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+        uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+static const uint32_t SHA256_INIT[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+static void storeState(const uint32_t state[8], unsigned char* out)
+{
+    for (int i = 0; i < 8; i++) 
+    {
+        out[i*4] = static_cast<unsigned char>(state[i] >> 24);
+        out[i*4+1] = static_cast<unsigned char>(state[i] >> 16);
+        out[i*4+2] = static_cast<unsigned char>(state[i] >> 8);
+        out[i*4+3] = static_cast<unsigned char>(state[i]);
+    }
+}
+
+// Incremental SHA-256, so HMAC can hash its pad block and the message without joining them in a string
+class Sha256
+{
+private:
+    uint32_t state[8];
+    unsigned char buffer[64];
+    size_t buffered = 0;
+    uint64_t length = 0;
+
+public:
+    Sha256() { memcpy(state, SHA256_INIT, sizeof(state)); }
+
+    void update(const void* data, size_t len)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        length += len;
+        if (buffered > 0) 
+        {
+            size_t n = std::min(len, sizeof(buffer) - buffered);
+            memcpy(buffer + buffered, bytes, n);
+            buffered += n;
+            bytes += n;
+            len -= n;
+            if (buffered < sizeof(buffer)) return;
+            sha256Block(state, buffer);
+            buffered = 0;
+        }
+        for (; len >= 64; bytes += 64, len -= 64) sha256Block(state, bytes);
+        memcpy(buffer, bytes, len);
+        buffered = len;
+    }
+
+    // Pads with the 0x80 marker, zeros and the bit length
+    void finish(unsigned char digest[32])
+    {
+        static const unsigned char padding[64] = {0x80};
+        unsigned char bits[8];
+        for (int i = 0; i < 8; i++) bits[i] = static_cast<unsigned char>((length * 8) >> (56 - 8 * i));
+        update(padding, buffered < 56 ? 56 - buffered : 120 - buffered);
+        update(bits, sizeof(bits));
+        storeState(state, digest);
+    }
+};
+
+std::string sha256(const std::string& data)
+{
+    Sha256 hash;
+    hash.update(data.data(), data.length());
+    unsigned char digest[32];
+    hash.finish(digest);
+    return std::string(reinterpret_cast<char*>(digest), 32);
+}
+
+std::string hmacSha256(const std::string& key, const std::string& data)
+{
+    unsigned char block_key[64] = {0};
+    if (key.length() > sizeof(block_key)) 
+    {
+        Sha256 key_hash;
+        key_hash.update(key.data(), key.length());
+        key_hash.finish(block_key);
+    }
+    else memcpy(block_key, key.data(), key.length());
+
+    unsigned char pad[64], digest[32];
+    for (int i = 0; i < 64; i++) pad[i] = block_key[i] ^ 0x36;
+    Sha256 inner;
+    inner.update(pad, sizeof(pad));
+    inner.update(data.data(), data.length());
+    inner.finish(digest);
+
+    for (int i = 0; i < 64; i++) pad[i] = block_key[i] ^ 0x5c;
+    Sha256 outer;
+    outer.update(pad, sizeof(pad));
+    outer.update(digest, sizeof(digest));
+    outer.finish(digest);
+    return std::string(reinterpret_cast<char*>(digest), 32);
+}
+
+// block = HMAC(key, block) for a 32-byte block, given the states after compressing the key's
+// inner and outer pad blocks. Both messages fit in one padded block, so this is two compressions.
+static void hmacDigestBlock(const uint32_t inner[8], const uint32_t outer[8], unsigned char block[32])
+{
+    // 32 message bytes after the 64-byte pad block: 0x80 marker, then a length of 96 * 8 bits
+    unsigned char padded[64] = {0};
+    memcpy(padded, block, 32);
+    padded[32] = 0x80;
+    padded[62] = 0x03;
+
+    uint32_t state[8];
+    memcpy(state, inner, sizeof(state));
+    sha256Block(state, padded);
+    storeState(state, padded);
+
+    memcpy(state, outer, sizeof(state));
+    sha256Block(state, padded);
+    storeState(state, block);
+}
+
+std::string pbkdf2Sha256(const std::string& password, const std::string& salt, unsigned int iterations, size_t len)
+{
+    std::string block_key = password.length() > 64 ? sha256(password) : password;
+    block_key.resize(64, '\0');
+
+    unsigned char inner_pad[64], outer_pad[64];
+    for (int i = 0; i < 64; i++) 
+    {
+        inner_pad[i] = block_key[i] ^ 0x36;
+        outer_pad[i] = block_key[i] ^ 0x5c;
+    }
+    uint32_t inner[8], outer[8];
+    memcpy(inner, SHA256_INIT, sizeof(inner));
+    memcpy(outer, SHA256_INIT, sizeof(outer));
+    sha256Block(inner, inner_pad);
+    sha256Block(outer, outer_pad);
+
+    std::string derived;
+    for (uint32_t index = 1; derived.length() < len; index++) 
+    {
+        std::string first = salt;
+        for (int shift = 24; shift >= 0; shift -= 8) first += static_cast<char>(index >> shift);
+
+        unsigned char block[32], result[32];
+        memcpy(block, hmacSha256(password, first).data(), 32);
+        memcpy(result, block, 32);
+        for (unsigned int i = 1; i < iterations; i++) 
+        {
+            hmacDigestBlock(inner, outer, block);
+            for (int j = 0; j < 32; j++) result[j] ^= block[j];
+        }
+        derived.append(reinterpret_cast<char*>(result), 32);
+    }
+    derived.resize(len);
+    return derived;
+}
+
+bool randomBytes(std::string& out, size_t len)
+{
+    out.assign(len, '\0');
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0) return false;
+
+    size_t filled = 0;
+    while (filled < len) 
+    {
+        ssize_t n = read(fd, &out[filled], len - filled);
+        if (n <= 0) break;
+        filled += n;
+    }
+    close(fd);
+    return filled == len;
+}
+
+bool constantTimeEquals(const std::string& a, const std::string& b)
+{
+    if (a.length() != b.length()) return false;
+    unsigned char diff = 0;
+    for (size_t i = 0; i < a.length(); i++) diff |= a[i] ^ b[i];
+    return diff == 0;
+}
+
+std::string toHex(const std::string& data)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(data.length() * 2);
+    for (unsigned char c : data) 
+    {
+        hex += digits[c >> 4];
+        hex += digits[c & 0x0f];
+    }
+    return hex;
+}
+
+static int hexValue(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+bool fromHex(const std::string& hex, std::string& out)
+{
+    if (hex.length() % 2 != 0) return false;
+    out.clear();
+    for (size_t i = 0; i < hex.length(); i += 2) 
+    {
+        int hi = hexValue(hex[i]), lo = hexValue(hex[i+1]);
+        if (hi < 0 || lo < 0) return false;
+        out += static_cast<char>((hi << 4) | lo);
+    }
+    return true;
+}
+
+std::string deriveResumeKey(const std::string& password, const std::string& nonce)
+{
+    return toHex(hmacSha256(password, "myssh-resume" + nonce));
+}
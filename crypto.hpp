@@ -0,0 +1,23 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Stream cipher shared by client and server; counter tracks the position in the keystream
+void encrypt_decrypt(char* data, size_t len, const std::string& key, unsigned long long& counter);
+
+std::string sha256(const std::string& data);
+std::string hmacSha256(const std::string& key, const std::string& data);
+
+// PBKDF2 with HMAC-SHA256 (RFC 8018), deriving `len` bytes
+std::string pbkdf2Sha256(const std::string& password, const std::string& salt, unsigned int iterations, size_t len);
+
+// Fills a string with bytes from /dev/urandom, returns false if the device can't be read
+bool randomBytes(std::string& out, size_t len);
+
+bool constantTimeEquals(const std::string& a, const std::string& b);
+std::string toHex(const std::string& data);
+bool fromHex(const std::string& hex, std::string& out);
+
+// Session key used after resuming with a ticket, derived from the login password and a server nonce
+std::string deriveResumeKey(const std::string& password, const std::string& nonce);
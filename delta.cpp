@@ -0,0 +1,134 @@
+#include "delta.hpp"
+#include <unordered_map>
+
+std::vector<std::string> splitLines(const std::string& text)
+{
+    std::vector<std::string> lines;
+    size_t begin = 0, newline;
+    while ((newline = text.find('\n', begin)) != std::string::npos) 
+    {
+        lines.push_back(text.substr(begin, newline - begin));
+        begin = newline + 1;
+    }
+    lines.push_back(text.substr(begin));
+    return lines;
+}
+
+std::string joinLines(const std::vector<std::string>& lines)
+{
+    std::string text;
+    for (size_t i = 0; i < lines.size(); i++) 
+    {
+        if (i > 0) text += '\n';
+        text += lines[i];
+    }
+    return text;
+}
+
+static void putVarint(std::string& out, size_t value)
+{
+    while (value >= 0x80) 
+    {
+        out += static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+static bool getVarint(const std::string& in, size_t& pos, size_t& value)
+{
+    value = 0;
+    for (int shift = 0; pos < in.length() && shift < 64; shift += 7) 
+    {
+        unsigned char byte = in[pos++];
+        value |= size_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+std::string encodeLineDelta(const std::vector<std::string>& previous, const std::vector<std::string>& current)
+{
+    // First occurrence of every previous line, for lines that moved (e.g. a new row in ps output)
+    std::unordered_map<std::string, size_t> index;
+    for (size_t i = previous.size(); i-- > 0;) index[previous[i]] = i;
+
+    std::string out;
+    size_t run_start = 0, run_length = 0;
+
+    auto flushRun = [&]() 
+    {
+        if (run_length == 0) return;
+        out += 'C';
+        putVarint(out, run_start);
+        putVarint(out, run_length);
+        run_length = 0;
+    };
+
+    for (size_t i = 0; i < current.size(); i++) 
+    {
+        const std::string& line = current[i];
+
+        // Extending the current copy run is the cheapest encoding
+        if (run_length > 0 && run_start + run_length < previous.size() && previous[run_start + run_length] == line) 
+        {
+            run_length++;
+            continue;
+        }
+        flushRun();
+
+        // Prefer the same position, so unchanged lines stay unchanged for the renderer
+        size_t source;
+        if (i < previous.size() && previous[i] == line) source = i;
+        else 
+        {
+            auto found = index.find(line);
+            if (found == index.end()) 
+            {
+                out += 'L';
+                putVarint(out, line.length());
+                out += line;
+                continue;
+            }
+            source = found->second;
+        }
+        run_start = source;
+        run_length = 1;
+    }
+    flushRun();
+    return out;
+}
+
+bool applyLineDelta(const std::vector<std::string>& previous, const std::string& payload, 
+                    std::vector<std::string>& current, std::vector<bool>& changed)
+{
+    current.clear();
+    changed.clear();
+    size_t pos = 0;
+
+    while (pos < payload.length()) 
+    {
+        char op = payload[pos++];
+        if (op == 'C') 
+        {
+            size_t start, count;
+            if (!getVarint(payload, pos, start) || !getVarint(payload, pos, count)) return false;
+            if (start > previous.size() || count > previous.size() - start) return false;
+            for (size_t i = start; i < start + count; i++) 
+            {
+                changed.push_back(i != current.size());
+                current.push_back(previous[i]);
+            }
+        }
+        else if (op == 'L') 
+        {
+            size_t length;
+            if (!getVarint(payload, pos, length) || length > payload.length() - pos) return false;
+            current.push_back(payload.substr(pos, length));
+            changed.push_back(true);
+            pos += length;
+        }
+        else return false;
+    }
+    return true;
+}
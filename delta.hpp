@@ -0,0 +1,19 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// Line-level delta between two snapshots of a command's output, used by watch mode.
+// The payload is a list of operations, each a tag byte followed by varints:
+//   'C' start count   copy `count` lines of the previous snapshot starting at `start`
+//   'L' length bytes  one literal line (without its newline)
+// Joining the resulting lines with '\n' gives the new output exactly.
+
+std::vector<std::string> splitLines(const std::string& text);
+std::string joinLines(const std::vector<std::string>& lines);
+
+std::string encodeLineDelta(const std::vector<std::string>& previous, const std::vector<std::string>& current);
+
+// Rebuilds `current` from `previous` and a payload; `changed[i]` is false when line i was copied
+// from the same position, so a renderer only needs to repaint the others
+bool applyLineDelta(const std::vector<std::string>& previous, const std::string& payload, 
+                    std::vector<std::string>& current, std::vector<bool>& changed);
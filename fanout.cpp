@@ -0,0 +1,314 @@
+#include "fanout.hpp"
+#include "crypto.hpp"
+#include "protocol.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define MAX_RESOLVER_THREADS 16
+
+using Clock = std::chrono::steady_clock;
+
+struct HostRun
+{
+    enum State { Pending, Connecting, Handshake, Running, Done };
+
+    std::string host;
+    struct sockaddr_in address;
+    bool resolved = false;
+    State state = Pending;
+    int fd = -1;
+    std::string outgoing;       // hello bytes not yet sent
+    std::string reply;          // plaintext handshake reply until its empty line arrives
+    FrameReader frames;
+    unsigned long long decrypt_counter = 0;
+    std::string partial_line;   // output after the last newline
+    int exit_code = -1;
+    std::string error;
+    Clock::time_point started;
+    Clock::time_point finished;
+};
+
+std::vector<std::string> readHostList(const std::string& path)
+{
+    std::vector<std::string> hosts;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) 
+    {
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) line.erase(comment);
+        std::istringstream words(line);
+        std::string host;
+        if (words >> host) hosts.push_back(host);
+    }
+    return hosts;
+}
+
+static bool resolve(const std::string& host, int default_port, struct sockaddr_in& address)
+{
+    std::string name = host;
+    int port = default_port;
+    size_t colon = host.rfind(':');
+    if (colon != std::string::npos) 
+    {
+        name = host.substr(0, colon);
+        port = atoi(host.c_str() + colon + 1);
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    if (inet_pton(AF_INET, name.c_str(), &address.sin_addr) == 1) return true;
+
+    struct addrinfo hints = {};
+    struct addrinfo* result = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(name.c_str(), nullptr, &hints, &result) != 0 || result == nullptr) return false;
+    address.sin_addr = reinterpret_cast<struct sockaddr_in*>(result->ai_addr)->sin_addr;
+    freeaddrinfo(result);
+    return true;
+}
+
+// Names are resolved before the event loop, a few at a time, so one slow DNS answer can't stall
+// the connects and timeouts of every other host
+static void resolveAll(std::vector<HostRun>& runs, int default_port, size_t threads)
+{
+    std::atomic<size_t> next{0};
+    auto resolver = [&]() 
+    {
+        for (size_t i = next++; i < runs.size(); i = next++) runs[i].resolved = resolve(runs[i].host, default_port, runs[i].address);
+    };
+
+    std::vector<std::thread> helpers;
+    for (size_t i = 1; i < threads; i++) helpers.emplace_back(resolver);
+    resolver();
+    for (auto& helper : helpers) helper.join();
+}
+
+static void finish(HostRun& run, const std::string& error = "")
+{
+    if (run.state == HostRun::Done) return;
+    if (!run.partial_line.empty()) std::cout << run.host << " | " << run.partial_line << "\n";
+    run.partial_line.clear();
+    if (!error.empty() && run.error.empty()) run.error = error;
+    if (run.fd >= 0) close(run.fd);
+    run.fd = -1;
+    run.state = HostRun::Done;
+    run.finished = Clock::now();
+}
+
+static void start(HostRun& run, const FanoutOptions& options, const std::string& hello)
+{
+    run.started = Clock::now();
+    run.outgoing = hello;
+
+    if (!run.resolved) 
+    {
+        finish(run, "cannot resolve host");
+        return;
+    }
+
+    run.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (run.fd < 0) 
+    {
+        finish(run, strerror(errno));
+        return;
+    }
+
+    if (connect(run.fd, reinterpret_cast<struct sockaddr*>(&run.address), sizeof(run.address)) == 0) run.state = HostRun::Handshake;
+    else if (errno == EINPROGRESS) run.state = HostRun::Connecting;
+    else finish(run, strerror(errno));
+}
+
+// Prints complete lines of output with the host as prefix, keeping hosts' lines from interleaving
+static void emitOutput(HostRun& run, const std::string& data)
+{
+    run.partial_line += data;
+    size_t begin = 0, newline;
+    std::string lines;
+    while ((newline = run.partial_line.find('\n', begin)) != std::string::npos) 
+    {
+        lines += run.host + " | " + run.partial_line.substr(begin, newline - begin + 1);
+        begin = newline + 1;
+    }
+    run.partial_line.erase(0, begin);
+    std::cout << lines;
+}
+
+static void receive(HostRun& run, const FanoutOptions& options)
+{
+    char buffer[16384];
+    ssize_t bytes_read = read(run.fd, buffer, sizeof(buffer));
+    if (bytes_read < 0 && (errno == EAGAIN || errno == EINTR)) return;
+    if (bytes_read <= 0) 
+    {
+        finish(run, run.exit_code < 0 ? "connection closed" : "");
+        return;
+    }
+
+    std::string data(buffer, bytes_read);
+    if (run.state == HostRun::Handshake) 
+    {
+        run.reply += data;
+        size_t end = run.reply.find("\n\n");
+        if (end == std::string::npos) return;
+
+        if (run.reply.compare(0, strlen(AUTH_SUCCESS), AUTH_SUCCESS) != 0) 
+        {
+            if (run.reply.compare(0, strlen(AUTH_THROTTLED), AUTH_THROTTLED) == 0) finish(run, "authentication throttled");
+            else if (run.reply.compare(0, strlen(SERVICE_UNAVAILABLE), SERVICE_UNAVAILABLE) == 0) finish(run, "service unavailable");
+            else finish(run, "authentication failed");
+            return;
+        }
+        data = run.reply.substr(end + 2);
+        run.state = HostRun::Running;
+    }
+
+    encrypt_decrypt(&data[0], data.length(), options.password, run.decrypt_counter);
+    run.frames.feed(data.data(), data.length());
+
+    char type;
+    std::string payload;
+    bool error;
+    while (run.frames.next(type, payload, error)) 
+    {
+        if (type == FRAME_OUTPUT) emitOutput(run, payload);
+        else if (type == FRAME_EXIT) run.exit_code = atoi(payload.c_str());
+    }
+    if (error) finish(run, "protocol error");
+}
+
+int runFanout(const FanoutOptions& options)
+{
+    std::string hello = std::string(PROTOCOL_HELLO) + " exec\nuser " + options.username + "\npass " + options.password + 
+                        "\nexec " + options.command + "\n\n";
+
+    std::vector<HostRun> runs(options.hosts.size());
+    for (size_t i = 0; i < runs.size(); i++) runs[i].host = options.hosts[i];
+
+    Clock::time_point begin = Clock::now();
+    resolveAll(runs, options.default_port, std::min<size_t>({runs.size(), static_cast<size_t>(options.parallel), MAX_RESOLVER_THREADS}));
+
+    size_t next = 0, active = 0, done = 0;
+    std::vector<struct pollfd> fds;
+    std::vector<HostRun*> polled;
+
+    while (done < runs.size()) 
+    {
+        // Keep up to `parallel` hosts in flight
+        while (active < static_cast<size_t>(options.parallel) && next < runs.size()) 
+        {
+            start(runs[next], options, hello);
+            if (runs[next].state == HostRun::Done) done++;
+            else active++;
+            next++;
+        }
+
+        fds.clear();
+        polled.clear();
+        int wait_ms = -1;
+        for (auto& run : runs) 
+        {
+            if (run.state == HostRun::Pending || run.state == HostRun::Done) continue;
+
+            short events = POLLIN;
+            if (run.state == HostRun::Connecting || !run.outgoing.empty()) events = POLLOUT;
+            fds.push_back({run.fd, events, 0});
+            polled.push_back(&run);
+
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                run.started + std::chrono::seconds(options.timeout) - Clock::now()).count();
+            if (wait_ms < 0 || remaining < wait_ms) wait_ms = std::max<long>(0, remaining);
+        }
+
+        if (!fds.empty() && poll(fds.data(), fds.size(), wait_ms) < 0 && errno != EINTR) 
+        {
+            // Hosts still in flight or not started get an error instead of a made-up duration in the summary
+            for (auto& run : runs) 
+            {
+                if (run.state == HostRun::Pending) run.started = Clock::now();
+                finish(run, "poll failed");
+            }
+            break;
+        }
+
+        for (size_t i = 0; i < fds.size(); i++) 
+        {
+            HostRun& run = *polled[i];
+
+            if (fds[i].revents & POLLOUT) 
+            {
+                if (run.state == HostRun::Connecting) 
+                {
+                    int error = 0;
+                    socklen_t len = sizeof(error);
+                    getsockopt(run.fd, SOL_SOCKET, SO_ERROR, &error, &len);
+                    if (error != 0) finish(run, strerror(error));
+                    else run.state = HostRun::Handshake;
+                }
+                else 
+                {
+                    ssize_t sent = send(run.fd, run.outgoing.data(), run.outgoing.length(), MSG_NOSIGNAL);
+                    if (sent > 0) run.outgoing.erase(0, sent);
+                    else if (errno != EAGAIN) finish(run, strerror(errno));
+                }
+            }
+            else if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) 
+            {
+                if (run.state == HostRun::Connecting) 
+                {
+                    int error = 0;
+                    socklen_t len = sizeof(error);
+                    getsockopt(run.fd, SOL_SOCKET, SO_ERROR, &error, &len);
+                    finish(run, strerror(error ? error : ECONNREFUSED));
+                }
+                else receive(run, options);
+            }
+
+            if (run.state != HostRun::Done && Clock::now() - run.started > std::chrono::seconds(options.timeout)) 
+            {
+                finish(run, "timed out");
+            }
+            if (run.state == HostRun::Done) 
+            {
+                active--;
+                done++;
+            }
+        }
+    }
+    std::cout << std::flush;
+
+    // Summary, in host list order
+    int failed = 0;
+    std::cerr << "\n";
+    for (const auto& run : runs) 
+    {
+        long ms = std::chrono::duration_cast<std::chrono::milliseconds>(run.finished - run.started).count();
+        bool ok = run.error.empty() && run.exit_code == 0;
+        if (!ok) failed++;
+
+        std::cerr << run.host << "  ";
+        if (!run.error.empty()) std::cerr << "error: " << run.error;
+        else std::cerr << "exit " << run.exit_code;
+        std::cerr << "  " << ms << " ms\n";
+    }
+
+    long total = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - begin).count();
+    std::cerr << runs.size() << " hosts, " << runs.size() - failed << " succeeded, " << failed << " failed, " 
+              << total << " ms total" << std::endl;
+    return failed == 0 ? 0 : 1;
+}
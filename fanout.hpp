@@ -0,0 +1,21 @@
+#pragma once
+#include <string>
+#include <vector>
+
+struct FanoutOptions
+{
+    std::vector<std::string> hosts; // "host" or "host:port"
+    std::string username;
+    std::string password;
+    std::string command;
+    int parallel = 32;   // connections open at the same time
+    int timeout = 30;    // seconds allowed per host
+    int default_port = 8090;
+};
+
+// Reads one host per line, ignoring blank lines and '#' comments
+std::vector<std::string> readHostList(const std::string& path);
+
+// Runs the command on every host in exec mode, printing output prefixed with the host and a
+// summary of exit codes and timings. Returns 0 when the command succeeded everywhere.
+int runFanout(const FanoutOptions& options);
@@ -0,0 +1,191 @@
+#include "latency.hpp"
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+
+static const char* const LEG_NAMES[LEG_COUNT] = {
+    "client -> server", "server -> pty -> server", "server -> client", "round trip"
+};
+
+uint64_t monotonicMicros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void LatencyHistogram::add(uint64_t micros)
+{
+    int bucket = 0;
+    while (bucket + 1 < BUCKETS && (micros >> (bucket + 1)) != 0) bucket++;
+    buckets[bucket]++;
+    total++;
+
+    uint64_t seen = max;
+    while (micros > seen && !max.compare_exchange_weak(seen, micros)) {}
+}
+
+uint64_t LatencyHistogram::percentile(double p) const
+{
+    uint64_t samples = total;
+    if (samples == 0) return 0;
+
+    uint64_t rank = static_cast<uint64_t>(p * samples);
+    if (rank >= samples) rank = samples - 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; ++i)
+    {
+        seen += buckets[i];
+        if (seen > rank) return (uint64_t(2) << i) - 1;
+    }
+    return max;
+}
+
+static std::string formatMicros(uint64_t micros)
+{
+    char text[32];
+    if (micros < 1000) snprintf(text, sizeof(text), "%lluus", static_cast<unsigned long long>(micros));
+    else if (micros < 1000000) snprintf(text, sizeof(text), "%.1fms", micros / 1000.0);
+    else snprintf(text, sizeof(text), "%.2fs", micros / 1000000.0);
+    return text;
+}
+
+std::string LatencyHistogram::format(const char* name, bool bars, const char* newline) const
+{
+    char line[160];
+    snprintf(line, sizeof(line), "%-24s n=%-6llu p50<%-8s p90<%-8s p99<%-8s max %s", name,
+             static_cast<unsigned long long>(count()), formatMicros(percentile(0.5)).c_str(),
+             formatMicros(percentile(0.9)).c_str(), formatMicros(percentile(0.99)).c_str(), formatMicros(max).c_str());
+    std::string text = std::string(line) + newline;
+    if (!bars || count() == 0) return text;
+
+    uint64_t largest = 0;
+    for (int i = 0; i < BUCKETS; ++i) largest = std::max<uint64_t>(largest, buckets[i]);
+    for (int i = 0; i < BUCKETS; ++i)
+    {
+        uint64_t n = buckets[i];
+        if (n == 0) continue;
+        std::string range = "<" + formatMicros((uint64_t(2) << i) - 1);
+        snprintf(line, sizeof(line), "    %9s %8llu ", range.c_str(), static_cast<unsigned long long>(n));
+        text += line + std::string(static_cast<size_t>(1 + 39 * n / largest), '#') + newline;
+    }
+    return text;
+}
+
+static void putU64(std::string& out, uint64_t value)
+{
+    for (int shift = 56; shift >= 0; shift -= 8) out += static_cast<char>((value >> shift) & 0xff);
+}
+
+static uint64_t getU64(const std::string& in, size_t pos)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i) value = (value << 8) | static_cast<unsigned char>(in[pos + i]);
+    return value;
+}
+
+LatencyTrace& sessionLatency()
+{
+    static LatencyTrace trace;
+    return trace;
+}
+
+std::string encodeProbeResult(uint64_t id, const uint64_t samples[LEG_COUNT])
+{
+    std::string payload;
+    putU64(payload, id);
+    for (int leg = 0; leg < LEG_COUNT; ++leg) putU64(payload, samples[leg]);
+    return payload;
+}
+
+bool decodeProbeResult(const std::string& payload, uint64_t& id, uint64_t samples[LEG_COUNT])
+{
+    if (payload.length() != (LEG_COUNT + 1) * 8) return false;
+    id = getU64(payload, 0);
+    for (int leg = 0; leg < LEG_COUNT; ++leg) samples[leg] = getU64(payload, (leg + 1) * 8);
+    return true;
+}
+
+void clampProbeResult(const ProbeTimes& times, uint64_t result_received, uint64_t samples[LEG_COUNT])
+{
+    uint64_t round_trip = result_received >= times.server_sent ? result_received - times.server_sent : 0;
+    samples[LEG_UPSTREAM] = std::min(samples[LEG_UPSTREAM], round_trip);
+    samples[LEG_DOWNSTREAM] = std::min(samples[LEG_DOWNSTREAM], round_trip);
+    samples[LEG_SERVER] = times.pty_answered >= times.server_received ? times.pty_answered - times.server_received : 0;
+    uint64_t held = times.server_sent >= times.server_received ? times.server_sent - times.server_received : 0;
+    samples[LEG_TOTAL] = std::min(samples[LEG_TOTAL], samples[LEG_UPSTREAM] + held + samples[LEG_DOWNSTREAM]);
+}
+
+void LatencyTrace::add(const uint64_t samples[LEG_COUNT])
+{
+    for (int leg = 0; leg < LEG_COUNT; ++leg) legs[leg].add(samples[leg]);
+}
+
+std::string LatencyTrace::format(bool bars, const char* newline) const
+{
+    std::string text;
+    for (int leg = 0; leg < LEG_COUNT; ++leg) text += legs[leg].format(LEG_NAMES[leg], bars, newline);
+    return text;
+}
+
+std::string encodeProbeRequest(uint64_t id, uint64_t client_sent, const char* keys, size_t len)
+{
+    std::string payload;
+    putU64(payload, id);
+    putU64(payload, client_sent);
+    payload.append(keys, len);
+    return payload;
+}
+
+bool decodeProbeRequest(const std::string& payload, ProbeTimes& times, std::string& keys)
+{
+    if (payload.length() < PROBE_REQUEST_SIZE) return false;
+    times = ProbeTimes();
+    times.id = getU64(payload, 0);
+    times.client_sent = getU64(payload, 8);
+    keys.assign(payload, PROBE_REQUEST_SIZE, std::string::npos);
+    return true;
+}
+
+std::string encodeProbeReply(const ProbeTimes& times)
+{
+    std::string payload;
+    putU64(payload, times.id);
+    putU64(payload, times.client_sent);
+    putU64(payload, times.server_received);
+    putU64(payload, times.pty_answered);
+    putU64(payload, times.server_sent);
+    return payload;
+}
+
+bool decodeProbeReply(const std::string& payload, ProbeTimes& times)
+{
+    if (payload.length() != PROBE_REPLY_SIZE) return false;
+    times.id = getU64(payload, 0);
+    times.client_sent = getU64(payload, 8);
+    times.server_received = getU64(payload, 16);
+    times.pty_answered = getU64(payload, 24);
+    times.server_sent = getU64(payload, 32);
+    return true;
+}
+
+void ProbeTimer::complete(const ProbeTimes& times, uint64_t client_received, uint64_t samples[LEG_COUNT])
+{
+    int64_t total = static_cast<int64_t>(client_received - times.client_sent);
+    int64_t server = static_cast<int64_t>(times.server_sent - times.server_received);
+    int64_t network = std::max<int64_t>(0, total - server);
+
+    if (static_cast<uint64_t>(network) <= best_round_trip)
+    {
+        best_round_trip = network;
+        offset = (static_cast<int64_t>(times.server_received - times.client_sent) +
+                  static_cast<int64_t>(times.server_sent - client_received)) / 2;
+    }
+
+    // Whatever the offset gets wrong moves time between the two network legs, never out of them
+    int64_t upstream = static_cast<int64_t>(times.server_received - times.client_sent) - offset;
+    upstream = std::min(std::max<int64_t>(0, upstream), network);
+
+    samples[LEG_UPSTREAM] = upstream;
+    samples[LEG_SERVER] = times.pty_answered >= times.server_received ? times.pty_answered - times.server_received : 0;
+    samples[LEG_DOWNSTREAM] = network - upstream;
+    samples[LEG_TOTAL] = std::max<int64_t>(0, total);
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <string>
+#include <atomic>
+#include <stdint.h>
+
+// Keystroke latency probes for interactive sessions. With tracing on, the client sends some
+// keystrokes as probe frames stamped with its clock; the server stamps when it got the probe,
+// when the PTY answered and when it sent the answer back, so the round trip splits into:
+//
+//   client -> server          network, client to server
+//   server -> pty -> server   server scheduling plus the shell's echo
+//   server -> client          network, server to client
+//   round trip                keystroke to echo on the client
+//
+// Each host stamps with its own monotonic clock, so the one-way legs rely on an estimated offset.
+
+enum LatencyLeg { LEG_UPSTREAM, LEG_SERVER, LEG_DOWNSTREAM, LEG_TOTAL, LEG_COUNT };
+
+// Microseconds on the monotonic clock; only meaningful against stamps from the same host
+uint64_t monotonicMicros();
+
+// Log2 histogram of microsecond samples: bucket i counts samples in [2^i, 2^(i+1)) us.
+// Updates are lock-free so session threads can record into shared histograms.
+class LatencyHistogram
+{
+public:
+    static const int BUCKETS = 32;
+
+    void add(uint64_t micros);
+    uint64_t count() const { return total; }
+
+    // Upper bound of the bucket holding the p-th percentile, p in [0, 1]
+    uint64_t percentile(double p) const;
+
+    // One summary line, plus a bar per non-empty bucket when `bars` is set
+    std::string format(const char* name, bool bars, const char* newline) const;
+
+private:
+    std::atomic<uint64_t> buckets[BUCKETS] = {};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> max{0};
+};
+
+struct LatencyTrace
+{
+    LatencyHistogram legs[LEG_COUNT];
+
+    void add(const uint64_t samples[LEG_COUNT]);
+    std::string format(bool bars, const char* newline) const;
+};
+
+// Stamps carried by a probe. Client -> server probes carry id and client_sent followed by the
+// keystrokes; the server's answer carries all five.
+struct ProbeTimes
+{
+    uint64_t id = 0;
+    uint64_t client_sent = 0;
+    uint64_t server_received = 0;
+    uint64_t pty_answered = 0;
+    uint64_t server_sent = 0;
+};
+
+#define PROBE_TIMEOUT_US 1000000 // a probe unanswered for this long is dropped
+
+#define PROBE_REQUEST_SIZE 16
+#define PROBE_REPLY_SIZE 40
+
+std::string encodeProbeRequest(uint64_t id, uint64_t client_sent, const char* keys, size_t len);
+bool decodeProbeRequest(const std::string& payload, ProbeTimes& times, std::string& keys);
+std::string encodeProbeReply(const ProbeTimes& times);
+bool decodeProbeReply(const std::string& payload, ProbeTimes& times);
+
+// The client reports each completed probe's id and legs back, so the server can export them too
+std::string encodeProbeResult(uint64_t id, const uint64_t samples[LEG_COUNT]);
+bool decodeProbeResult(const std::string& payload, uint64_t& id, uint64_t samples[LEG_COUNT]);
+
+#define MAX_UNREPORTED_PROBES 8 // answered probes a session keeps waiting for their results
+
+// Bounds a reported result by the server's stamps for the same probe. The server leg becomes the
+// server's own measurement, each network leg is capped at the round trip from sending the answer
+// to receiving the result, and the total can't exceed the capped legs plus the time the server held it.
+void clampProbeResult(const ProbeTimes& times, uint64_t result_received, uint64_t samples[LEG_COUNT]);
+
+// Results reported by all traced sessions of this server process
+LatencyTrace& sessionLatency();
+
+// Splits a probe reply into legs. The clock offset between the hosts is estimated NTP-style from
+// the probe with the smallest network round trip seen so far, which is the least skewed one.
+class ProbeTimer
+{
+private:
+    int64_t offset = 0;              // server clock minus client clock
+    uint64_t best_round_trip = UINT64_MAX;
+
+public:
+    void complete(const ProbeTimes& times, uint64_t client_received, uint64_t samples[LEG_COUNT]);
+};
@@ -0,0 +1,163 @@
+#include "memory.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <malloc.h>
+
+#define SLAB_SIZE (64 * 1024)
+
+SlabPool::SlabPool(size_t block_size, size_t blocks_per_slab)
+    : block_size(std::max(block_size, sizeof(FreeBlock))), blocks_per_slab(std::max<size_t>(1, blocks_per_slab)) {}
+
+SlabPool::~SlabPool()
+{
+    for (char* slab : slabs) free(slab);
+}
+
+void* SlabPool::allocate()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (free_list == nullptr)
+    {
+        char* slab = static_cast<char*>(aligned_alloc(alignof(std::max_align_t), block_size * blocks_per_slab));
+        if (slab == nullptr) throw std::bad_alloc();
+        slabs.push_back(slab);
+
+        // Thread the new blocks onto the free list back to front so they're handed out in address order
+        for (size_t i = blocks_per_slab; i-- > 0; )
+        {
+            FreeBlock* block = reinterpret_cast<FreeBlock*>(slab + i * block_size);
+            block->next = free_list;
+            free_list = block;
+        }
+    }
+
+    FreeBlock* block = free_list;
+    free_list = block->next;
+    in_use++;
+    return block;
+}
+
+void SlabPool::release(void* block)
+{
+    if (block == nullptr) return;
+    std::lock_guard<std::mutex> guard(lock);
+    FreeBlock* freed = static_cast<FreeBlock*>(block);
+    freed->next = free_list;
+    free_list = freed;
+    in_use--;
+}
+
+size_t SlabPool::blocksInUse()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return in_use;
+}
+
+size_t SlabPool::reservedBytes()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return slabs.size() * block_size * blocks_per_slab;
+}
+
+SlabPool& ioBufferPool()
+{
+    static SlabPool pool(IO_BUFFER_SIZE, SLAB_SIZE / IO_BUFFER_SIZE);
+    return pool;
+}
+
+static const size_t SESSION_SIZE_CLASSES[] = {256, 512, 1024, 2048};
+
+static SlabPool* sessionPool(size_t size)
+{
+    static SlabPool pools[] = {
+        SlabPool(256, SLAB_SIZE / 256), SlabPool(512, SLAB_SIZE / 512),
+        SlabPool(1024, SLAB_SIZE / 1024), SlabPool(2048, SLAB_SIZE / 2048)
+    };
+    for (size_t i = 0; i < sizeof(SESSION_SIZE_CLASSES) / sizeof(SESSION_SIZE_CLASSES[0]); ++i)
+    {
+        if (size <= SESSION_SIZE_CLASSES[i]) return &pools[i];
+    }
+    return nullptr;
+}
+
+void* allocateSessionObject(size_t size)
+{
+    SlabPool* pool = sessionPool(size);
+    return pool ? pool->allocate() : ::operator new(size);
+}
+
+void releaseSessionObject(void* object, size_t size)
+{
+    SlabPool* pool = sessionPool(size);
+    if (pool) pool->release(object);
+    else ::operator delete(object);
+}
+
+static std::mutex sessions_lock;
+static std::vector<SessionAccount*> sessions;
+static std::atomic<size_t> stack_size{0};
+
+void registerSession(SessionAccount* account)
+{
+    std::lock_guard<std::mutex> guard(sessions_lock);
+    sessions.push_back(account);
+}
+
+void unregisterSession(SessionAccount* account)
+{
+    std::lock_guard<std::mutex> guard(sessions_lock);
+    auto it = std::find(sessions.begin(), sessions.end(), account);
+    if (it == sessions.end()) return;
+    *it = sessions.back();
+    sessions.pop_back();
+}
+
+void setSessionStackSize(size_t bytes)
+{
+    stack_size = bytes;
+}
+
+size_t sessionStackSize()
+{
+    return stack_size;
+}
+
+// Resident set size from /proc/self/statm, in bytes
+static size_t residentBytes()
+{
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm == nullptr) return 0;
+    unsigned long size = 0, resident = 0;
+    if (fscanf(statm, "%lu %lu", &size, &resident) != 2) resident = 0;
+    fclose(statm);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+void writeMemoryReport(std::ostream& out)
+{
+    std::lock_guard<std::mutex> guard(sessions_lock);
+    time_t now = time(nullptr);
+    size_t heap_total = 0;
+
+    out << "Memory report: " << sessions.size() << " session(s), stack " << sessionStackSize() / 1024 << " KB each\n";
+    for (const SessionAccount* account : sessions)
+    {
+        heap_total += account->heap_bytes;
+        out << "  " << account->username << " " << account->kind.load() << " up " << (now - account->started)
+            << "s heap " << account->heap_bytes << " B\n";
+    }
+
+    size_t buffers = ioBufferPool().blocksInUse();
+    size_t rss = residentBytes();
+    out << "  session heap total " << heap_total << " B, I/O buffers in use " << buffers
+        << " (" << ioBufferPool().reservedBytes() / 1024 << " KB reserved)\n";
+    struct mallinfo2 heap = mallinfo2();
+    out << "  malloc in use " << heap.uordblks / 1024 << " KB of " << (heap.arena + heap.hblkhd) / 1024 << " KB obtained\n";
+    out << "  process RSS " << rss / 1024 << " KB";
+    if (!sessions.empty()) out << ", " << rss / 1024 / sessions.size() << " KB per session";
+    out << std::endl;
+}
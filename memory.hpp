@@ -0,0 +1,79 @@
+#pragma once
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <ostream>
+#include <time.h>
+
+#define IO_BUFFER_SIZE 4096
+
+// Fixed-size block allocator. Blocks are carved out of larger slabs and recycled through a
+// free list, so sessions that come and go don't fragment the heap and idle memory stays reusable.
+class SlabPool
+{
+private:
+    struct FreeBlock { FreeBlock* next; };
+
+    size_t block_size;
+    size_t blocks_per_slab;
+    std::mutex lock;
+    FreeBlock* free_list = nullptr;
+    std::vector<char*> slabs;
+    size_t in_use = 0;
+
+public:
+    SlabPool(size_t block_size, size_t blocks_per_slab);
+    ~SlabPool();
+    SlabPool(const SlabPool&) = delete;
+    SlabPool& operator=(const SlabPool&) = delete;
+
+    void* allocate();
+    void release(void* block);
+
+    size_t blockSize() const { return block_size; }
+    size_t blocksInUse();
+    size_t reservedBytes();
+};
+
+// Pool of IO_BUFFER_SIZE buffers for socket and pipe I/O
+SlabPool& ioBufferPool();
+
+// A pooled I/O buffer held only while data is being moved, so idle sessions own none
+class IOBuffer
+{
+private:
+    char* block;
+
+public:
+    IOBuffer() : block(static_cast<char*>(ioBufferPool().allocate())) {}
+    ~IOBuffer() { ioBufferPool().release(block); }
+    IOBuffer(const IOBuffer&) = delete;
+    IOBuffer& operator=(const IOBuffer&) = delete;
+
+    char* data() { return block; }
+    size_t size() const { return IO_BUFFER_SIZE; }
+};
+
+// Session objects are allocated from size-class pools instead of the per-thread malloc arenas
+void* allocateSessionObject(size_t size);
+void releaseSessionObject(void* object, size_t size);
+
+// Per-session memory figures, updated by the session thread at safe points and read by the report
+struct SessionAccount
+{
+    std::string username;
+    std::atomic<const char*> kind{""};
+    time_t started = 0;
+    std::atomic<size_t> heap_bytes{0};
+};
+
+void registerSession(SessionAccount* account);
+void unregisterSession(SessionAccount* account);
+
+// Stack size for session threads, included in the per-session figures
+void setSessionStackSize(size_t bytes);
+size_t sessionStackSize();
+
+// Writes one line per session plus pool and process totals
+void writeMemoryReport(std::ostream& out);
@@ -0,0 +1,341 @@
+#include "pathindex.hpp"
+#include "memory.hpp"
+#include <algorithm>
+#include <dirent.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+static bool byName(const DirEntry& entry, const std::string& name)
+{
+    return entry.name < name;
+}
+
+static void statEntry(const std::string& path, DirEntry& entry)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+    {
+        entry.is_dir = false;
+        entry.is_exec = false;
+        return;
+    }
+    entry.is_dir = S_ISDIR(st.st_mode);
+    entry.is_exec = !entry.is_dir && access(path.c_str(), X_OK) == 0;
+}
+
+// Heap bytes behind a name, which is zero for names short enough to be stored inline
+static size_t nameBytes(const std::string& name)
+{
+    return name.capacity() > 15 ? name.capacity() + 1 : 0;
+}
+
+static std::string childPath(const std::string& dir, const std::string& name)
+{
+    return dir == "/" ? "/" + name : dir + "/" + name;
+}
+
+PathIndex::~PathIndex()
+{
+    if (inotify_fd >= 0) close(inotify_fd);
+}
+
+// The inotify instance is only created once a directory is listed, so sessions that never glob or
+// complete don't hold one; without inotify every listing falls back to mtime validation
+int PathIndex::watchFd()
+{
+    if (!inotify_tried) 
+    {
+        inotify_tried = true;
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    }
+    return inotify_fd;
+}
+
+bool PathIndex::scan(const std::string& path, Listing& listing)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) return false;
+
+    // Watch before reading so nothing that changes during the scan is missed;
+    // events for entries the scan already saw are harmless to apply twice
+    if (listing.wd < 0 && watchFd() >= 0)
+    {
+        int wd = inotify_add_watch(inotify_fd, path.c_str(), WATCH_EVENTS);
+        auto owner = watches.find(wd);
+        // The same directory reached through another path shares the watch, so leave this one unwatched
+        if (wd >= 0 && (owner == watches.end() || owner->second == path))
+        {
+            listing.wd = wd;
+            watches[wd] = path;
+        }
+    }
+
+    DIR* dir = opendir(path.c_str());
+    if (dir == nullptr) return false;
+
+    std::vector<DirEntry> entries;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+        DirEntry item = {entry->d_name, entry->d_type == DT_DIR, false};
+        // Executable bits are only needed for the search path, which keeps big directories stat-free
+        if (listing.pinned || entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK)
+        {
+            statEntry(childPath(path, item.name), item);
+        }
+        entries.push_back(std::move(item));
+    }
+    closedir(dir);
+
+    std::sort(entries.begin(), entries.end(), [](const DirEntry& a, const DirEntry& b) { return a.name < b.name; });
+
+    listing.name_bytes = 0;
+    for (const auto& item : entries) listing.name_bytes += nameBytes(item.name);
+    listing.entries = std::move(entries);
+    listing.mtime = st.st_mtim;
+    listing.scanned_at = time(nullptr);
+    listing.stale = false;
+    return true;
+}
+
+void PathIndex::forget(const std::string& path)
+{
+    auto it = listings.find(path);
+    if (it == listings.end()) return;
+
+    if (it->second.wd >= 0)
+    {
+        inotify_rm_watch(inotify_fd, it->second.wd);
+        watches.erase(it->second.wd);
+    }
+    listings.erase(it);
+}
+
+void PathIndex::applyEvent(int wd, unsigned int mask, const char* name)
+{
+    if (mask & IN_Q_OVERFLOW)
+    {
+        for (auto& item : listings) item.second.stale = true;
+        return;
+    }
+
+    auto watch = watches.find(wd);
+    if (watch == watches.end()) return;
+    std::string path = watch->second;
+
+    if (mask & IN_IGNORED)
+    {
+        // The kernel dropped the watch (directory deleted or unmounted), so the listing can't be trusted
+        watches.erase(watch);
+        listings.erase(path);
+        return;
+    }
+    if (mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+    {
+        forget(path);
+        return;
+    }
+
+    auto it = listings.find(path);
+    if (it == listings.end() || name == nullptr || name[0] == '\0') return;
+    Listing& listing = it->second;
+
+    std::string entry_name = name;
+    auto pos = std::lower_bound(listing.entries.begin(), listing.entries.end(), entry_name, byName);
+    bool present = pos != listing.entries.end() && pos->name == entry_name;
+
+    if (mask & (IN_DELETE | IN_MOVED_FROM))
+    {
+        if (present) 
+        {
+            listing.name_bytes -= nameBytes(pos->name);
+            listing.entries.erase(pos);
+        }
+    }
+    else if (mask & (IN_CREATE | IN_MOVED_TO | IN_ATTRIB))
+    {
+        // Attribute changes only matter for executable bits on the search path
+        if ((mask & IN_ATTRIB) && !listing.pinned) return;
+
+        DirEntry entry = {entry_name, (mask & IN_ISDIR) != 0, false};
+        if (listing.pinned || !(mask & IN_ISDIR)) statEntry(childPath(path, entry_name), entry);
+
+        if (present) *pos = std::move(entry);
+        else if (!(mask & IN_ATTRIB)) 
+        {
+            listing.name_bytes += nameBytes(entry.name);
+            listing.entries.insert(pos, std::move(entry));
+        }
+    }
+}
+
+void PathIndex::refresh()
+{
+    if (inotify_fd >= 0)
+    {
+        IOBuffer events;
+        char* buffer = events.data();
+        while (true)
+        {
+            ssize_t length = read(inotify_fd, buffer, events.size());
+            if (length <= 0) break;
+
+            for (ssize_t offset = 0; offset < length; )
+            {
+                const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(buffer + offset);
+                applyEvent(event->wd, event->mask, event->len > 0 ? event->name : nullptr);
+                offset += sizeof(struct inotify_event) + event->len;
+            }
+        }
+    }
+
+    evict();
+}
+
+// Drops the least recently used listings beyond the budget; the search path stays
+void PathIndex::evict()
+{
+    while (listings.size() > MAX_INDEXED_DIRS + search_path.size())
+    {
+        auto oldest = listings.end();
+        for (auto it = listings.begin(); it != listings.end(); ++it)
+        {
+            if (it->second.pinned) continue;
+            if (oldest == listings.end() || it->second.last_used < oldest->second.last_used) oldest = it;
+        }
+        if (oldest == listings.end()) break;
+        forget(oldest->first);
+    }
+}
+
+const std::vector<DirEntry>* PathIndex::list(const std::string& dir)
+{
+    std::string path = dir;
+    while (path.length() > 1 && path.back() == '/') path.pop_back();
+
+    auto it = listings.find(path);
+    if (it != listings.end())
+    {
+        Listing& cached = it->second;
+        cached.last_used = ++use_clock;
+        if (cached.wd >= 0 && !cached.stale) return &cached.entries;
+
+        if (cached.wd < 0 && !cached.stale)
+        {
+            struct stat st;
+            if (stat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) return nullptr;
+            bool unchanged = cached.mtime.tv_sec == st.st_mtim.tv_sec && cached.mtime.tv_nsec == st.st_mtim.tv_nsec;
+            // A change in the same second as the scan may not have moved the mtime, so don't trust those
+            if (unchanged && st.st_mtim.tv_sec < cached.scanned_at) return &cached.entries;
+        }
+        return scan(path, cached) ? &cached.entries : nullptr;
+    }
+
+    Listing listing;
+    listing.pinned = std::find(search_path.begin(), search_path.end(), path) != search_path.end();
+    listing.last_used = ++use_clock;
+    if (!scan(path, listing))
+    {
+        if (listing.wd >= 0)
+        {
+            inotify_rm_watch(inotify_fd, listing.wd);
+            watches.erase(listing.wd);
+        }
+        return nullptr;
+    }
+
+    // Evicting here rather than at the next refresh() keeps one deep glob from watching every
+    // directory it walks; the new listing is the most recently used, so it stays
+    Listing& slot = listings[path];
+    slot = std::move(listing);
+    evict();
+    return &slot.entries;
+}
+
+size_t PathIndex::memoryUsage() const
+{
+    size_t bytes = search_path_var.capacity();
+    for (const auto& dir : search_path) bytes += sizeof(dir) + nameBytes(dir);
+    for (const auto& item : listings) 
+    {
+        bytes += sizeof(item) + nameBytes(item.first) + item.second.name_bytes;
+        bytes += item.second.entries.capacity() * sizeof(DirEntry);
+    }
+    return bytes + watches.size() * (sizeof(int) + sizeof(std::string));
+}
+
+void PathIndex::setSearchPath(const std::string& path_var)
+{
+    if (path_var == search_path_var) return;
+    search_path_var = path_var;
+
+    for (const auto& dir : search_path)
+    {
+        auto it = listings.find(dir);
+        if (it != listings.end()) it->second.pinned = false;
+    }
+
+    search_path.clear();
+    size_t begin = 0;
+    while (begin <= path_var.length())
+    {
+        size_t colon = path_var.find(':', begin);
+        if (colon == std::string::npos) colon = path_var.length();
+        std::string dir = path_var.substr(begin, colon - begin);
+        if (!dir.empty() && dir[0] == '/' && std::find(search_path.begin(), search_path.end(), dir) == search_path.end())
+        {
+            search_path.push_back(dir);
+        }
+        begin = colon + 1;
+    }
+
+    // Listings scanned without executable bits have to be read again as search path directories
+    for (const auto& dir : search_path)
+    {
+        auto it = listings.find(dir);
+        if (it == listings.end()) continue;
+        it->second.pinned = true;
+        it->second.stale = true;
+    }
+}
+
+void PathIndex::completeFile(const std::string& dir, const std::string& prefix, size_t limit, std::vector<std::string>& matches)
+{
+    const std::vector<DirEntry>* entries = list(dir);
+    if (entries == nullptr) return;
+
+    bool show_hidden = !prefix.empty() && prefix[0] == '.';
+    for (auto it = std::lower_bound(entries->begin(), entries->end(), prefix, byName);
+         it != entries->end() && matches.size() < limit && it->name.compare(0, prefix.length(), prefix) == 0; ++it)
+    {
+        if (it->name[0] == '.' && !show_hidden) continue;
+        matches.push_back(it->is_dir ? it->name + "/" : it->name);
+    }
+}
+
+void PathIndex::completeCommand(const std::string& prefix, size_t limit, std::vector<std::string>& matches)
+{
+    std::vector<std::string> found;
+    for (const auto& dir : search_path)
+    {
+        const std::vector<DirEntry>* entries = list(dir);
+        if (entries == nullptr) continue;
+
+        for (auto it = std::lower_bound(entries->begin(), entries->end(), prefix, byName);
+             it != entries->end() && it->name.compare(0, prefix.length(), prefix) == 0; ++it)
+        {
+            if (it->is_exec) found.push_back(it->name);
+        }
+    }
+
+    std::sort(found.begin(), found.end());
+    found.erase(std::unique(found.begin(), found.end()), found.end());
+    if (found.size() > limit) found.resize(limit);
+    matches.insert(matches.end(), found.begin(), found.end());
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <time.h>
+
+struct DirEntry
+{
+    std::string name;
+    bool is_dir;
+    bool is_exec; // only tracked for search path directories
+};
+
+// Per-session index of directory listings used by globbing and tab completion.
+// A directory is read once and then kept current from inotify events, so lookups never
+// touch the disk again; directories that can't be watched fall back to mtime validation.
+class PathIndex
+{
+private:
+    static const size_t MAX_INDEXED_DIRS = 64;
+
+    struct Listing
+    {
+        int wd = -1;              // inotify watch, -1 when unwatched
+        bool pinned = false;      // search path directories are never evicted
+        bool stale = false;       // events were lost, rescan on next use
+        struct timespec mtime;    // validation for unwatched directories
+        time_t scanned_at = 0;
+        unsigned long long last_used = 0;
+        size_t name_bytes = 0;         // heap held by long entry names, for memoryUsage()
+        std::vector<DirEntry> entries; // sorted by name
+    };
+
+    int inotify_fd = -1;
+    bool inotify_tried = false;
+    std::unordered_map<std::string, Listing> listings;
+    std::unordered_map<int, std::string> watches;
+    std::string search_path_var;
+    std::vector<std::string> search_path;
+    unsigned long long use_clock = 0;
+
+    int watchFd();
+    bool scan(const std::string& path, Listing& listing);
+    void applyEvent(int wd, unsigned int mask, const char* name);
+    void forget(const std::string& path);
+    void evict();
+
+public:
+    PathIndex() = default;
+    ~PathIndex();
+    PathIndex(const PathIndex&) = delete;
+    PathIndex& operator=(const PathIndex&) = delete;
+
+    // Applies pending inotify events and evicts old listings
+    void refresh();
+
+    // Sorted listing of an absolute directory path, or nullptr if it can't be read. Listing a new
+    // directory evicts the least recently used one beyond the budget, so the pointer is only valid
+    // until the next list() or refresh() call.
+    const std::vector<DirEntry>* list(const std::string& path);
+
+    // Sets the directories searched for commands, from a colon separated PATH value
+    void setSearchPath(const std::string& path_var);
+
+    // Heap held by the index
+    size_t memoryUsage() const;
+
+    // Appends up to `limit` names in `dir` starting with `prefix`; directories get a trailing '/'
+    void completeFile(const std::string& dir, const std::string& prefix, size_t limit, std::vector<std::string>& matches);
+
+    // Appends up to `limit` executables on the search path starting with `prefix`, sorted and without duplicates
+    void completeCommand(const std::string& prefix, size_t limit, std::vector<std::string>& matches);
+};
@@ -0,0 +1,113 @@
+#include "protocol.hpp"
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+bool readHelloMessage(int socket, std::string& raw)
+{
+    // On the heap: a page-sized stack buffer would stay resident for the whole session
+    std::string storage(MAX_HELLO_SIZE, '\0');
+    char* buffer = &storage[0];
+    raw.clear();
+
+    while (raw.length() < MAX_HELLO_SIZE) 
+    {
+        // Peek first so bytes the client sent after the hello stay in the socket
+        int bytes_read = recv(socket, buffer, MAX_HELLO_SIZE - raw.length(), MSG_PEEK);
+        if (bytes_read <= 0) return false;
+
+        // The terminator may straddle what was already consumed and the peeked bytes
+        size_t search_from = raw.empty() ? 0 : raw.length() - 1;
+        size_t end = (raw + std::string(buffer, bytes_read)).find("\n\n", search_from);
+        size_t take = end == std::string::npos ? bytes_read : end + 2 - raw.length();
+
+        if (read(socket, buffer, take) != static_cast<ssize_t>(take)) return false;
+        raw.append(buffer, take);
+        if (end != std::string::npos) return true;
+    }
+    return false;
+}
+
+bool parseHello(const std::string& raw, Hello& hello)
+{
+    std::istringstream lines(raw);
+    std::string line;
+    if (!std::getline(lines, line) || line.compare(0, strlen(PROTOCOL_HELLO), PROTOCOL_HELLO) != 0) return false;
+    hello = Hello();
+    if (line.length() > strlen(PROTOCOL_HELLO) + 1) hello.mode = line.substr(strlen(PROTOCOL_HELLO) + 1);
+
+    while (std::getline(lines, line)) 
+    {
+        size_t space = line.find(' ');
+        if (space == std::string::npos) continue;
+        std::string field = line.substr(0, space);
+        std::string value = line.substr(space + 1);
+
+        if (field == "user") hello.username = value;
+        else if (field == "pass") hello.password = value;
+        else if (field == "ticket") hello.ticket = value;
+        else if (field == "exec") hello.command = value;
+        else if (field == "interval") 
+        {
+            // Bounded here so the watch loop's clock arithmetic can't overflow
+            char* end;
+            double seconds = strtod(value.c_str(), &end);
+            if (end == value.c_str() || *end != '\0' || !std::isfinite(seconds)) return false;
+            hello.interval = std::min(seconds, MAX_WATCH_INTERVAL);
+        }
+        else if (field == "trace") hello.trace = value == "on";
+    }
+    return true;
+}
+
+void appendFrame(std::string& out, char type, const char* data, size_t len)
+{
+    out += type;
+    for (int shift = 24; shift >= 0; shift -= 8) out += static_cast<char>((len >> shift) & 0xff);
+    out.append(data, len);
+}
+
+#define MAX_IDLE_FRAME_BUFFER 4096
+
+void FrameReader::feed(const char* data, size_t len)
+{
+    // Drop consumed bytes only once they dominate the buffer, to avoid shifting on every frame
+    if (offset > 0 && offset >= buffer.length() / 2) 
+    {
+        buffer.erase(0, offset);
+        offset = 0;
+    }
+    buffer.append(data, len);
+}
+
+bool FrameReader::next(char& type, std::string& payload, bool& error)
+{
+    error = false;
+    if (buffer.length() - offset < FRAME_HEADER_SIZE) return false;
+
+    const unsigned char* header = reinterpret_cast<const unsigned char*>(buffer.data() + offset);
+    size_t len = (size_t(header[1]) << 24) | (size_t(header[2]) << 16) | (size_t(header[3]) << 8) | header[4];
+    if (len > MAX_FRAME_SIZE) 
+    {
+        error = true;
+        return false;
+    }
+    if (buffer.length() - offset < FRAME_HEADER_SIZE + len) return false;
+
+    type = header[0];
+    payload.assign(buffer, offset + FRAME_HEADER_SIZE, len);
+    offset += FRAME_HEADER_SIZE + len;
+
+    // Once everything is consumed, give back the memory a large frame left behind
+    if (offset == buffer.length()) 
+    {
+        buffer.clear();
+        offset = 0;
+        if (buffer.capacity() > MAX_IDLE_FRAME_BUFFER) buffer.shrink_to_fit();
+    }
+    return true;
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <string>
+
+// Login handshake. The client sends everything in a single write:
+//
+//   MYSSH/1 <interactive|command|exec|watch>\n
+//   user <username>\n
+//   pass <password>\n        (or)   ticket <hex>\n
+//   exec <command line>\n    (exec and watch modes)
+//   interval <seconds>\n     (watch mode)
+//   trace on\n               (interactive mode, frames the stream and adds latency probes)
+//   \n
+//
+// The server replies with a status line, for password logins a resumption ticket line
+// "Ticket <ticket hex> <nonce hex> <expiry>", and an empty line. The encrypted session stream
+// starts right after it. A resumed session is keyed with deriveResumeKey(password, nonce).
+// A ticket the server can't accept is answered with "Ticket rejected\n\n" and the client may
+// send a fresh hello with credentials on the same connection.
+
+#define PROTOCOL_HELLO "MYSSH/1"
+#define MAX_HELLO_SIZE 4096
+
+#define AUTH_SUCCESS "Authentication success"
+#define AUTH_FAILED "Authentication failed"
+#define TICKET_REJECTED "Ticket rejected"
+#define AUTH_THROTTLED "Authentication throttled" // too many attempts or logins waiting, retry later
+#define SERVICE_UNAVAILABLE "Service unavailable"     // a proxy with no healthy backend to pass the login to
+
+#define MAX_WATCH_INTERVAL 86400.0
+
+struct Hello 
+{
+    std::string mode;
+    std::string username;
+    std::string password;
+    std::string ticket;
+    std::string command;
+    double interval = 2.0;     // at most MAX_WATCH_INTERVAL; a value that isn't a finite number fails the hello
+    bool trace = false;
+};
+
+// Reads one hello message, including its terminating empty line, without consuming anything after it
+bool readHelloMessage(int socket, std::string& raw);
+bool parseHello(const std::string& raw, Hello& hello);
+
+// After the handshake, command and exec sessions exchange frames inside the encrypted stream:
+// type(1) | payload length(4, big endian) | payload. Interactive sessions stay a raw byte stream
+// unless latency tracing was asked for, in which case they carry 'I', 'O' and probe frames.
+#define FRAME_HEADER_SIZE 5
+#define MAX_FRAME_SIZE (1 << 24)
+
+#define FRAME_INPUT 'I'   // client -> server: one command line
+#define FRAME_OUTPUT 'O'  // server -> client: command output or error text
+#define FRAME_PROMPT 'P'  // server -> client: prompt, the server is ready for the next line
+#define FRAME_EXIT 'X'    // server -> client: exit status of the last pipeline, decimal text
+#define FRAME_WATCH 'W'   // server -> client: watch mode output as a line delta (see delta.hpp)
+#define FRAME_COMPLETE 'T'     // client -> server: line up to the cursor, asks for completions
+#define FRAME_COMPLETIONS 'M'  // server -> client: word start offset, then one candidate per line
+#define FRAME_PROBE 'K'        // both ways: keystroke latency probe and its stamped answer (see latency.hpp)
+#define FRAME_PROBE_RESULT 'R' // client -> server: a completed probe's id and the legs it measured
+
+#define MAX_COMPLETIONS 256
+
+// Appends an unencrypted frame to `out`
+void appendFrame(std::string& out, char type, const char* data, size_t len);
+
+// Reassembles frames from decrypted stream bytes that may arrive in arbitrary pieces
+class FrameReader
+{
+private:
+    std::string buffer;
+    size_t offset = 0;
+
+public:
+    void feed(const char* data, size_t len);
+
+    // Returns false until a whole frame is buffered; sets `error` on a malformed length
+    bool next(char& type, std::string& payload, bool& error);
+};
@@ -0,0 +1,223 @@
+#include "proxy.hpp"
+#include "protocol.hpp"
+#include <algorithm>
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define RELAY_BUFFER_SIZE 16384
+#define CONNECT_TIMEOUT_MS 1000
+
+int connectToAddress(const std::string& address, int timeout_ms)
+{
+    struct sockaddr_storage storage = {};
+    socklen_t length;
+
+    if (address.compare(0, 5, "unix:") == 0) 
+    {
+        struct sockaddr_un* addr = reinterpret_cast<struct sockaddr_un*>(&storage);
+        std::string path = address.substr(5);
+        if (path.length() >= sizeof(addr->sun_path)) return -1;
+        addr->sun_family = AF_UNIX;
+        strcpy(addr->sun_path, path.c_str());
+        length = sizeof(struct sockaddr_un);
+    }
+    else 
+    {
+        size_t colon = address.rfind(':');
+        if (colon == std::string::npos) return -1;
+        struct sockaddr_in* addr = reinterpret_cast<struct sockaddr_in*>(&storage);
+        addr->sin_family = AF_INET;
+        addr->sin_port = htons(atoi(address.c_str() + colon + 1));
+        if (inet_pton(AF_INET, address.substr(0, colon).c_str(), &addr->sin_addr) <= 0) return -1;
+        length = sizeof(struct sockaddr_in);
+    }
+
+    int sock = socket(storage.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) return -1;
+
+    // Non-blocking connect so a dead backend can't stall the caller
+    int flags = fcntl(sock, F_GETFL);
+    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+    if (connect(sock, reinterpret_cast<struct sockaddr*>(&storage), length) < 0 && errno != EINPROGRESS) 
+    {
+        close(sock);
+        return -1;
+    }
+
+    struct pollfd pfd = {sock, POLLOUT, 0};
+    int error = 0;
+    socklen_t error_len = sizeof(error);
+    if (poll(&pfd, 1, timeout_ms) != 1 || getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &error_len) < 0 || error != 0) 
+    {
+        close(sock);
+        return -1;
+    }
+
+    fcntl(sock, F_SETFL, flags);
+    return sock;
+}
+
+static uint64_t fnv1a(const std::string& data)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : data) 
+    {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+LoadBalancer::LoadBalancer(const ProxyConfig& config) 
+    : mode(config.mode), health_interval(config.health_interval)
+{
+    for (const auto& address : config.backends) 
+    {
+        auto backend = std::make_unique<Backend>();
+        backend->address = address;
+        for (int i = 0; i < VIRTUAL_NODES; i++) 
+        {
+            ring.emplace_back(fnv1a(address + "#" + std::to_string(i)), backend.get());
+        }
+        backends.push_back(std::move(backend));
+    }
+    std::sort(ring.begin(), ring.end());
+}
+
+void LoadBalancer::start()
+{
+    sigset_t drain_signals, previous;
+    sigemptyset(&drain_signals);
+    sigaddset(&drain_signals, SIGTERM);
+    sigaddset(&drain_signals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &drain_signals, &previous);
+    std::thread(&LoadBalancer::healthLoop, this).detach();
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+}
+
+// Probes every backend with a plain connect; a draining backend has closed its listener and fails
+void LoadBalancer::healthLoop()
+{
+    while (true) 
+    {
+        for (auto& backend : backends) 
+        {
+            int sock = connectToAddress(backend->address, CONNECT_TIMEOUT_MS);
+            bool up = sock >= 0;
+            if (up) close(sock);
+
+            if (up != backend->healthy.exchange(up)) 
+            {
+                std::cout << "Backend " << backend->address << (up ? " is up" : " is down") << std::endl;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(health_interval));
+    }
+}
+
+Backend* LoadBalancer::pick(const std::string& username)
+{
+    if (mode == BalanceMode::HashByUser && !username.empty() && !ring.empty()) 
+    {
+        // Walk clockwise from the user's point on the ring to the first healthy backend
+        auto start = std::lower_bound(ring.begin(), ring.end(), std::make_pair(fnv1a(username), static_cast<Backend*>(nullptr)));
+        for (size_t i = 0; i < ring.size(); i++) 
+        {
+            size_t index = (start - ring.begin() + i) % ring.size();
+            if (ring[index].second->healthy) return ring[index].second;
+        }
+        return nullptr;
+    }
+
+    Backend* best = nullptr;
+    for (auto& backend : backends) 
+    {
+        if (!backend->healthy) continue;
+        if (best == nullptr || backend->active_sessions < best->active_sessions) best = backend.get();
+    }
+    return best;
+}
+
+int LoadBalancer::activeSessions() const
+{
+    int total = 0;
+    for (const auto& backend : backends) total += backend->active_sessions;
+    return total;
+}
+
+static bool writeAll(int fd, const char* data, size_t len)
+{
+    while (len > 0) 
+    {
+        ssize_t written = write(fd, data, len);
+        if (written <= 0) return false;
+        data += written;
+        len -= written;
+    }
+    return true;
+}
+
+void LoadBalancer::relay(int client_socket, int backend_socket)
+{
+    char buffer[RELAY_BUFFER_SIZE];
+    struct pollfd fds[2] = {{client_socket, POLLIN, 0}, {backend_socket, POLLIN, 0}};
+
+    while (poll(fds, 2, -1) > 0) 
+    {
+        for (int i = 0; i < 2; i++) 
+        {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+            ssize_t bytes_read = read(fds[i].fd, buffer, sizeof(buffer));
+            if (bytes_read <= 0 || !writeAll(fds[1 - i].fd, buffer, bytes_read)) return;
+        }
+    }
+}
+
+void LoadBalancer::handleClient(int client_socket)
+{
+    // Only the hello is read here, to learn the user for hashing; the backend authenticates
+    std::string raw;
+    Hello hello;
+    if (!readHelloMessage(client_socket, raw) || !parseHello(raw, hello)) 
+    {
+        close(client_socket);
+        return;
+    }
+
+    // A backend that refuses the connection is marked down and the next choice is tried
+    Backend* backend = nullptr;
+    int backend_socket = -1;
+    for (size_t attempt = 0; attempt < backends.size() && backend_socket < 0; attempt++) 
+    {
+        backend = pick(hello.username);
+        if (backend == nullptr) break;
+        backend_socket = connectToAddress(backend->address, CONNECT_TIMEOUT_MS);
+        if (backend_socket < 0) backend->healthy = false;
+    }
+
+    if (backend_socket < 0) 
+    {
+        std::string reply = SERVICE_UNAVAILABLE "\n\n";
+        send(client_socket, reply.c_str(), reply.length(), 0);
+        close(client_socket);
+        return;
+    }
+
+    backend->active_sessions++;
+    if (writeAll(backend_socket, raw.c_str(), raw.length())) relay(client_socket, backend_socket);
+    backend->active_sessions--;
+
+    close(backend_socket);
+    close(client_socket);
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+
+enum class BalanceMode
+{
+    LeastSessions,
+    HashByUser
+};
+
+struct Backend
+{
+    std::string address; // "host:port" or "unix:/path"
+    std::atomic<int> active_sessions{0};
+    std::atomic<bool> healthy{true};
+};
+
+struct ProxyConfig
+{
+    std::vector<std::string> backends;
+    BalanceMode mode = BalanceMode::LeastSessions;
+    int health_interval = 2; // seconds
+};
+
+// Connects to "host:port" or "unix:/path", giving up after timeout_ms; returns -1 on failure
+int connectToAddress(const std::string& address, int timeout_ms);
+
+// Front proxy: reads each client's hello, picks a healthy backend server and relays the
+// connection to it unchanged, so authentication and tickets are handled by the backend
+class LoadBalancer
+{
+private:
+    static const int VIRTUAL_NODES = 64;
+
+    std::vector<std::unique_ptr<Backend>> backends;
+    std::vector<std::pair<uint64_t, Backend*>> ring; // consistent hash ring, sorted by hash
+    BalanceMode mode;
+    int health_interval;
+
+    Backend* pick(const std::string& username);
+    void healthLoop();
+    void relay(int client_socket, int backend_socket);
+
+public:
+    explicit LoadBalancer(const ProxyConfig& config);
+
+    void start();
+    void handleClient(int client_socket);
+    int activeSessions() const;
+};
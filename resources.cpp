@@ -0,0 +1,202 @@
+#include "resources.hpp"
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <errno.h>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CGROUP_MOUNT "/sys/fs/cgroup"
+#define BATCH_NICE 5
+#define INTERACTIVE_CPU_WEIGHT 400
+#define BATCH_CPU_WEIGHT 100
+
+static std::string sessions_root;  // empty when cgroups are unavailable
+static ResourcePolicy session_defaults;
+static std::mutex policy_mutex;
+static std::atomic<unsigned long> next_session_id{0};
+static struct rlimit original_files = {RLIM_INFINITY, RLIM_INFINITY};
+static bool files_raised = false;
+
+long long parseSize(const std::string& text)
+{
+    if (text.empty()) return -1;
+    size_t digits = 0;
+    long long value = 0;
+    while (digits < text.length() && isdigit(static_cast<unsigned char>(text[digits]))) 
+    {
+        int digit = text[digits] - '0';
+        if (value > (LLONG_MAX - digit) / 10) return -1;
+        value = value * 10 + digit;
+        digits++;
+    }
+    if (digits == 0) return -1;
+    if (digits == text.length()) return value;
+    if (digits + 1 != text.length()) return -1;
+
+    int shift;
+    switch (toupper(static_cast<unsigned char>(text[digits]))) 
+    {
+        case 'K': shift = 10; break;
+        case 'M': shift = 20; break;
+        case 'G': shift = 30; break;
+        default: return -1;
+    }
+    if (value > (LLONG_MAX >> shift)) return -1;
+    return value << shift;
+}
+
+static bool writeFile(const std::string& path, const std::string& value)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    bool ok = write(fd, value.c_str(), value.length()) == static_cast<ssize_t>(value.length());
+    close(fd);
+    return ok;
+}
+
+// Enables each controller separately so one missing controller doesn't disable the rest
+static void enableControllers(const std::string& group)
+{
+    for (const char* controller : {"+cpu", "+memory", "+pids"}) 
+    {
+        writeFile(group + "/cgroup.subtree_control", controller);
+    }
+}
+
+// cpu.weight is passed separately: the policy's weight belongs to the user's group, while session
+// groups always get their class weight
+static void writeLimits(const std::string& group, const ResourcePolicy& policy, long weight)
+{
+    if (policy.max_procs > 0) writeFile(group + "/pids.max", std::to_string(policy.max_procs));
+    if (policy.memory_max > 0) writeFile(group + "/memory.max", std::to_string(policy.memory_max));
+    if (weight > 0) writeFile(group + "/cpu.weight", std::to_string(weight));
+}
+
+// The stricter of two limits, where zero means "not limited"
+static long long stricter(long long a, long long b)
+{
+    if (a == 0 || b == 0) return a + b;
+    return std::min(a, b);
+}
+
+bool initResourceControl()
+{
+    std::ifstream self("/proc/self/cgroup");
+    std::string line, own_path;
+    while (std::getline(self, line)) 
+    {
+        if (line.compare(0, 3, "0::") == 0) own_path = line.substr(3);
+    }
+    if (own_path.empty()) return false;
+
+    std::string root = CGROUP_MOUNT + (own_path == "/" ? "" : own_path);
+    if (access((root + "/cgroup.controllers").c_str(), F_OK) != 0) return false; // not a cgroup v2 mount
+
+    // cgroup v2 only allows controllers on groups without processes, so the server moves into a leaf
+    std::string server_group = root + "/myssh-server";
+    if (mkdir(server_group.c_str(), 0755) != 0 && errno != EEXIST) return false;
+    if (!writeFile(server_group + "/cgroup.procs", std::to_string(getpid()))) return false;
+
+    enableControllers(root);
+    std::string sessions = root + "/myssh-sessions";
+    if (mkdir(sessions.c_str(), 0755) != 0 && errno != EEXIST) return false;
+    enableControllers(sessions);
+
+    sessions_root = sessions;
+    return true;
+}
+
+void setSessionPolicy(const ResourcePolicy& policy)
+{
+    std::lock_guard<std::mutex> lock(policy_mutex);
+    session_defaults = policy;
+}
+
+SessionResources::SessionResources(const std::string& username, const ResourcePolicy& user_policy, SessionClass cls)
+    : session_class(cls)
+{
+    {
+        std::lock_guard<std::mutex> lock(policy_mutex);
+        session_policy = session_defaults;
+    }
+    child_limits.max_files = stricter(user_policy.max_files, session_policy.max_files);
+    child_limits.memory_max = stricter(user_policy.memory_max, session_policy.memory_max);
+
+    if (sessions_root.empty() || username.empty() || username.find('/') != std::string::npos || username[0] == '.') return;
+
+    // Users share CPU fairly at the user level; the session class decides the split inside a user
+    std::string user_group = sessions_root + "/" + username;
+    if (mkdir(user_group.c_str(), 0755) != 0 && errno != EEXIST) return;
+    enableControllers(user_group);
+    // --cpu-weight is the default for users without a cpu_weight of their own
+    writeLimits(user_group, user_policy, user_policy.cpu_weight > 0 ? user_policy.cpu_weight : session_policy.cpu_weight);
+
+    // Siblings compare only with each other, so the class ratio holds whatever the user's weight is
+    std::string group = user_group + "/s" + std::to_string(getpid()) + "-" + std::to_string(next_session_id++);
+    if (mkdir(group.c_str(), 0755) != 0) return;
+    writeLimits(group, session_policy, session_class == SessionClass::Interactive ? INTERACTIVE_CPU_WEIGHT : BATCH_CPU_WEIGHT);
+
+    procs_fd = open((group + "/cgroup.procs").c_str(), O_WRONLY | O_CLOEXEC);
+    if (procs_fd < 0) 
+    {
+        rmdir(group.c_str());
+        return;
+    }
+    cgroup_path = group;
+}
+
+SessionResources::~SessionResources()
+{
+    if (procs_fd >= 0) close(procs_fd);
+    // Fails while background jobs are still running, in which case the group stays behind
+    if (!cgroup_path.empty()) rmdir(cgroup_path.c_str());
+}
+
+void raiseFileLimit()
+{
+    struct rlimit files;
+    if (getrlimit(RLIMIT_NOFILE, &files) != 0 || files.rlim_cur >= files.rlim_max) return;
+    original_files = files;
+    files.rlim_cur = files.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &files) == 0) files_raised = true;
+}
+
+void SessionResources::applyToChild() const
+{
+    if (procs_fd >= 0) 
+    {
+        char pid[32];
+        int len = snprintf(pid, sizeof(pid), "%d", getpid());
+        write(procs_fd, pid, len);
+    }
+
+    // No RLIMIT_NPROC: it counts every process and thread of the UID, the server's session threads
+    // included, so it can't limit one session. max_procs is only enforced through pids.max.
+    struct rlimit limit;
+    if (child_limits.max_files > 0) 
+    {
+        limit.rlim_cur = limit.rlim_max = child_limits.max_files;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    else if (files_raised) setrlimit(RLIMIT_NOFILE, &original_files);
+    if (child_limits.memory_max > 0) 
+    {
+        limit.rlim_cur = limit.rlim_max = child_limits.memory_max;
+        setrlimit(RLIMIT_AS, &limit);
+    }
+
+    if (session_class == SessionClass::Batch) 
+    {
+        struct sched_param param = {};
+        sched_setscheduler(0, SCHED_BATCH, &param);
+        setpriority(PRIO_PROCESS, 0, BATCH_NICE);
+    }
+}
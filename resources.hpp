@@ -0,0 +1,56 @@
+#pragma once
+#include <string>
+
+// Limits for a user or a session. Zero means "not limited".
+struct ResourcePolicy
+{
+    long max_procs = 0;        // pids.max, so only with cgroups
+    long max_files = 0;        // RLIMIT_NOFILE, per process
+    long long memory_max = 0;  // bytes, memory.max, and RLIMIT_AS per process
+    long cpu_weight = 0;       // cpu.weight of the user's group, 1-10000
+};
+
+// Interactive PTY sessions are scheduled ahead of batch command sessions under contention
+enum class SessionClass
+{
+    Interactive,
+    Batch
+};
+
+// Parses sizes like "512M" or "2G"; returns -1 on malformed input or a size that overflows
+long long parseSize(const std::string& text);
+
+// Sets up the cgroup v2 hierarchy used for sessions. Must run before any thread is started,
+// because it moves the server process into its own leaf group. Returns false when cgroups
+// are unavailable, in which case only rlimits and nice levels are applied and max_procs
+// is not enforced.
+bool initResourceControl();
+
+// Limits applied to every session on top of the per-user policy
+void setSessionPolicy(const ResourcePolicy& policy);
+
+// Raises the server's descriptor soft limit to the hard limit, since every session holds a socket.
+// Session children get the original soft limit back in applyToChild().
+void raiseFileLimit();
+
+// Resource group for one session: a cgroup under the user's group (when available), plus
+// rlimits and a scheduling class applied to every child the session spawns
+class SessionResources
+{
+private:
+    std::string cgroup_path;
+    int procs_fd = -1;
+    SessionClass session_class;
+    ResourcePolicy session_policy;
+    ResourcePolicy child_limits; // the stricter of the user and session policies, for the rlimits
+
+public:
+    SessionResources(const std::string& username, const ResourcePolicy& user_policy, SessionClass cls);
+    ~SessionResources();
+
+    SessionResources(const SessionResources&) = delete;
+    SessionResources& operator=(const SessionResources&) = delete;
+
+    // Called in the child between fork() and exec()
+    void applyToChild() const;
+};
@@ -8,24 +8,38 @@
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <map>
+#include <sstream>
+#include <sys/select.h>
 #include "shell.hpp"
+#include "protocol.hpp"
+#include "resources.hpp"
+#include "proxy.hpp"
+#include "memory.hpp"
+#include "auth.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <iterator>
+#include <poll.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <termios.h>
+#include <cerrno>
+#include <climits>
 
 #define PORT 8090
 #define BUFFER_SIZE 4096
-
-void encrypt_decrypt(char* data, size_t len, const std::string& key, unsigned long long& counter) 
-{
-    for (size_t i = 0; i < len; i++) 
-    {
-        data[i] = data[i] ^ key[(counter++) % key.length()];
-    }
-}
-
+#define MIN_WATCH_INTERVAL 0.1
+#define DEFAULT_THREAD_STACK (256 * 1024)
+#define MIN_THREAD_STACK (64 * 1024)
+#define MAX_TICKET_USERNAME 255
 
 struct User 
 {
     std::string username;
     std::string password;
+    ResourcePolicy limits;
 };
 
 class JsonParser {
@@ -37,28 +51,39 @@ private:
         return str.substr(first, last - first + 1);
     }
 
-    static void parseUserObject(const std::string& line, std::vector<User>& users) {
-        size_t usernamePos = line.find("\"username\":");
-        size_t passwordPos = line.find("\"password\":");
-        
-        if (usernamePos == std::string::npos || passwordPos == std::string::npos) return;
+    // Returns the raw value of "key": on the line, or an empty string if the key is missing
+    static std::string findValue(const std::string& line, const std::string& key) {
+        size_t keyPos = line.find("\"" + key + "\":");
+        if (keyPos == std::string::npos) return "";
+
+        size_t start = line.find_first_not_of(" \t", line.find(':', keyPos) + 1);
+        if (start == std::string::npos) return "";
 
-        // Find the value after "username":
-        size_t usernameStart = line.find(':', usernamePos) + 1;
-        size_t usernameEnd = line.find(',', usernameStart);
-        
-        // Find the value after "password":
-        size_t passwordStart = line.find(':', passwordPos) + 1;
-        size_t passwordEnd = line.find('}', passwordStart);
+        // Quoted values may contain commas and braces
+        size_t end = line[start] == '"' ? line.find('"', start + 1) + 1 : line.find_first_of(",}", start);
+        if (end == std::string::npos || end == 0) end = line.length();
+        return trim(line.substr(start, end - start));
+    }
 
-        if (usernameStart == std::string::npos || passwordStart == std::string::npos) return;
+    static long findNumber(const std::string& line, const std::string& key) {
+        std::string value = findValue(line, key);
+        long long number = parseSize(value);
+        return number < 0 ? 0 : number;
+    }
 
-        std::string username = trim(line.substr(usernameStart, usernameEnd - usernameStart));
-        std::string password = trim(line.substr(passwordStart, passwordEnd - passwordStart));
+    static void parseUserObject(const std::string& line, std::vector<User>& users) {
+        if (line.find("\"username\":") == std::string::npos || line.find("\"password\":") == std::string::npos) return;
 
         User user;
-        user.username = username;
-        user.password = password;
+        user.username = findValue(line, "username");
+        user.password = findValue(line, "password");
+
+        // Optional per-user resource limits: max_procs, max_files, memory_max ("512M") and cpu_weight
+        user.limits.max_procs = findNumber(line, "max_procs");
+        user.limits.max_files = findNumber(line, "max_files");
+        user.limits.memory_max = parseSize(findValue(line, "memory_max"));
+        if (user.limits.memory_max < 0) user.limits.memory_max = 0;
+        user.limits.cpu_weight = findNumber(line, "cpu_weight");
         users.push_back(user);
     }
 
@@ -86,69 +111,216 @@ public:
     }
 };
 
-bool authenticateUser(const std::vector<User>& users, const std::string& username, const std::string& password) 
+// Entry from users.json, or nullptr for unknown users
+static const User* findUser(const std::vector<User>& users, const std::string& username) 
 {
     for (const auto& user : users) 
     {
-        if (user.username == username && user.password == password) return true;
+        if (user.username == username) return &user;
     }
-    return false;
+    return nullptr;
 }
 
+// Logins run on a worker pool, see CredentialVerifier
+static std::unique_ptr<CredentialVerifier> credential_verifier;
 
+// Runs on the verifier's workers; users.json is read on every login so edits apply without a restart
+static bool findAccount(const std::string& username, std::string& stored, ResourcePolicy& limits)
+{
+    std::vector<User> users = JsonParser::parseUsersFile("users.json");
+    const User* user = findUser(users, username);
+    if (user == nullptr) return false;
+    stored = user->password;
+    limits = user->limits;
+    return true;
+}
 
-bool authenticate(int client_socket, std::string& password, std::string& username) 
+// Rate limits are kept per source address; behind the proxy every client shares the proxy's.
+// The key is the raw address, since inet_ntop()'s printf would take login a stack page deeper.
+static std::string peerAddress(int client_socket)
 {
-    char buffer[BUFFER_SIZE];
+    struct sockaddr_storage address = {};
+    socklen_t length = sizeof(address);
+    if (getpeername(client_socket, reinterpret_cast<struct sockaddr*>(&address), &length) != 0) return "unknown";
 
-    std::string prompt = "Username: ";
-    send(client_socket, prompt.c_str(), prompt.length(), 0);
-    
-    int bytes_read = read(client_socket, buffer, BUFFER_SIZE);
-    if (bytes_read <= 0) return false;
-    username = std::string(buffer, bytes_read);
+    if (address.ss_family == AF_INET) 
+    {
+        const struct in_addr& ip = reinterpret_cast<struct sockaddr_in*>(&address)->sin_addr;
+        return std::string(reinterpret_cast<const char*>(&ip), sizeof(ip));
+    }
+    if (address.ss_family == AF_INET6) 
+    {
+        const struct in6_addr& ip = reinterpret_cast<struct sockaddr_in6*>(&address)->sin6_addr;
+        return std::string(reinterpret_cast<const char*>(&ip), sizeof(ip));
+    }
+    return "local";
+}
 
-    prompt = "Password: ";
-    send(client_socket, prompt.c_str(), prompt.length(), 0);
-    
-    bytes_read = read(client_socket, buffer, BUFFER_SIZE);
-    if (bytes_read <= 0) return false;
-    password = std::string(buffer, bytes_read);
-    
-    std::vector<User> users = JsonParser::parseUsersFile("users.json");
 
-    if (authenticateUser(users, username, password))
+
+// Ticket key is generated per process, so tickets don't survive a server restart
+static std::string ticket_key;
+static std::string ticket_enc_key, ticket_mac_key; // derived from ticket_key once it's set
+static time_t ticket_lifetime = 12 * 60 * 60;
+
+static void deriveTicketKeys()
+{
+    ticket_enc_key = hmacSha256(ticket_key, "ticket-enc");
+    ticket_mac_key = hmacSha256(ticket_key, "ticket-mac");
+}
+
+// Keystream for ticket encryption: HMAC blocks over the nonce and a block counter
+static std::string ticketKeystream(const std::string& nonce, size_t len)
+{
+    std::string stream, input = nonce + '\0';
+    stream.reserve(len + 32);
+    for (unsigned char block = 0; stream.length() < len; block++) 
     {
-        std::string success_msg = "Authentication success\n";
-        send(client_socket, success_msg.c_str(), success_msg.length(), 0);
-        return true;
-    } 
-    else 
+        input.back() = static_cast<char>(block);
+        stream += hmacSha256(ticket_enc_key, input);
+    }
+    return stream;
+}
+
+// Ticket layout: nonce(16) | ciphertext of [expiry(8) | username length(1) | username | session key] | tag(32)
+std::string sealTicket(const std::string& username, const std::string& session_key, time_t expiry)
+{
+    // The length field is one byte; longer names just don't get a ticket and log in with credentials
+    if (username.length() > MAX_TICKET_USERNAME) return "";
+
+    // Sealed in place: login runs on the session thread, which keeps whatever it frees cached for its lifetime
+    std::string sealed;
+    if (!randomBytes(sealed, 16)) return "";
+    sealed.reserve(16 + 9 + username.length() + session_key.length() + 32);
+    for (int i = 7; i >= 0; i--) sealed += static_cast<char>(static_cast<uint64_t>(expiry) >> (8 * i));
+    sealed += static_cast<char>(username.length());
+    sealed += username;
+    sealed += session_key;
+
+    std::string stream = ticketKeystream(sealed.substr(0, 16), sealed.length() - 16);
+    for (size_t i = 16; i < sealed.length(); i++) sealed[i] ^= stream[i - 16];
+    sealed += hmacSha256(ticket_mac_key, sealed);
+    return toHex(sealed);
+}
+
+bool openTicket(const std::string& hex, std::string& username, std::string& session_key)
+{
+    std::string raw;
+    if (!fromHex(hex, raw) || raw.length() < 16 + 9 + 32) return false;
+
+    std::string sealed = raw.substr(0, raw.length() - 32);
+    std::string tag = raw.substr(raw.length() - 32);
+    if (!constantTimeEquals(tag, hmacSha256(ticket_mac_key, sealed))) return false;
+
+    std::string plain = sealed.substr(16);
+    std::string stream = ticketKeystream(sealed.substr(0, 16), plain.length());
+    for (size_t i = 0; i < plain.length(); i++) plain[i] ^= stream[i];
+
+    uint64_t expiry = 0;
+    for (int i = 0; i < 8; i++) expiry = (expiry << 8) | static_cast<unsigned char>(plain[i]);
+    if (static_cast<time_t>(expiry) < time(nullptr)) return false;
+
+    size_t name_len = static_cast<unsigned char>(plain[8]);
+    if (plain.length() < 9 + name_len) return false;
+    username = plain.substr(9, name_len);
+    session_key = plain.substr(9 + name_len);
+    return !session_key.empty();
+}
+
+static void sendReply(int client_socket, const std::string& reply)
+{
+    send(client_socket, reply.c_str(), reply.length(), 0);
+}
+
+// Authenticates the client from a single hello; on success `session_key` is the key for the encrypted
+// stream, `hello` holds the requested mode and `policy` the user's resource limits from users.json
+bool authenticate(int client_socket, std::string& session_key, std::string& username, Hello& hello, ResourcePolicy& policy) 
+{
+    std::string raw;
+    if (!readHelloMessage(client_socket, raw) || !parseHello(raw, hello)) return false;
+
+    if (!hello.ticket.empty()) 
     {
-        std::string error_msg = "Authentication failed\n";
-        send(client_socket, error_msg.c_str(), error_msg.length(), 0);
+        if (openTicket(hello.ticket, username, session_key)) 
+        {
+            // Limits are read on a worker. A user since removed from users.json gets Rejected, which
+            // revokes their tickets like an invalid one.
+            VerifyResult result = credential_verifier->lookup(username, policy);
+            if (result == VerifyResult::Busy) 
+            {
+                sendReply(client_socket, AUTH_THROTTLED "\n\n");
+                return false;
+            }
+            if (result == VerifyResult::Accepted) 
+            {
+                sendReply(client_socket, AUTH_SUCCESS "\n\n");
+                return true;
+            }
+        }
+
+        // Give the client one chance to fall back to credentials
+        sendReply(client_socket, TICKET_REJECTED "\n\n");
+        if (!readHelloMessage(client_socket, raw) || !parseHello(raw, hello) || !hello.ticket.empty()) return false;
+    }
+
+    username = hello.username;
+    VerifyResult result = credential_verifier->verify(peerAddress(client_socket), username, hello.password, policy);
+    if (result != VerifyResult::Accepted)
+    {
+        bool throttled = result == VerifyResult::RateLimited || result == VerifyResult::Busy;
+        sendReply(client_socket, throttled ? AUTH_THROTTLED "\n\n" : AUTH_FAILED "\n\n");
         return false;
     }
+
+    session_key = hello.password;
+
+    std::string reply = AUTH_SUCCESS "\n";
+    std::string nonce;
+    bool one_shot = hello.mode == "exec" || hello.mode == "watch";
+    if (ticket_lifetime > 0 && !one_shot && randomBytes(nonce, 16)) 
+    {
+        time_t expiry = time(nullptr) + ticket_lifetime;
+        std::string ticket = sealTicket(username, deriveResumeKey(hello.password, nonce), expiry);
+        if (!ticket.empty()) 
+        {
+            reply.reserve(reply.length() + ticket.length() + 80);
+            reply.append("Ticket ").append(ticket).append(" ").append(toHex(nonce)).append(" ").append(std::to_string(expiry)).append("\n");
+        }
+    }
+    reply += "\n";
+    sendReply(client_socket, reply);
+    return true;
 }
 
 void handle_client(int client_socket, bool interactive_mode) 
 {
-    std::string password, username;
-    if(!authenticate(client_socket, password, username)) 
+    std::string session_key, username;
+    Hello hello;
+    ResourcePolicy policy;
+    if(!authenticate(client_socket, session_key, username, hello, policy)) 
     {
         shutdown(client_socket, SHUT_RDWR);
         close(client_socket);
         return;
     }
 
-    if (interactive_mode) 
+    if (hello.mode == "exec") 
     {
-        auto shell = createShell(true, client_socket, username, password);
-        shell->run();
+        CommandShell shell(client_socket, username, session_key, policy);
+        shell.runOnce(hello.command);
+    }
+    else if (hello.mode == "watch") 
+    {
+        CommandShell shell(client_socket, username, session_key, policy);
+        shell.runWatch(hello.command, std::max(MIN_WATCH_INTERVAL, hello.interval));
     }
-    else
+    else 
     {
-        auto shell = createShell(false, client_socket, username, password);
+        // Clients that don't ask for a mode get the server's default
+        if (hello.mode == "interactive") interactive_mode = true;
+        else if (hello.mode == "command") interactive_mode = false;
+
+        auto shell = createShell(interactive_mode, client_socket, username, session_key, policy, hello.trace);
         shell->run();
     }
 
@@ -156,61 +328,380 @@ void handle_client(int client_socket, bool interactive_mode)
     close(client_socket);
 }
 
+// Set by SIGTERM/SIGINT: stop accepting, let running sessions finish, then exit
+static volatile sig_atomic_t drain_requested = 0;
+static std::atomic<int> active_sessions{0};
+
+// Set by SIGUSR1: print the per-session memory report and keystroke latency histograms from the main thread
+static volatile sig_atomic_t report_requested = 0;
+
+static void requestReport(int)
+{
+    report_requested = 1;
+}
+
+struct SessionStart
+{
+    int socket;
+    bool interactive_mode;
+    LoadBalancer* balancer;
+};
+
+static void* sessionThread(void* arg)
+{
+    SessionStart start = *static_cast<SessionStart*>(arg);
+    delete static_cast<SessionStart*>(arg);
+
+    if (start.balancer) start.balancer->handleClient(start.socket);
+    else handle_client(start.socket, start.interactive_mode);
+    active_sessions--;
+    return nullptr;
+}
+
+static void requestDrain(int)
+{
+    // A second signal while draining exits immediately
+    if (drain_requested) _exit(EXIT_FAILURE);
+    drain_requested = 1;
+}
+
+static int listenOn(int port, const std::string& unix_path)
+{
+    int server_fd;
+    if (!unix_path.empty()) 
+    {
+        struct sockaddr_un address = {};
+        if (unix_path.length() >= sizeof(address.sun_path) || (server_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) 
+        {
+            perror("Socket failed");
+            exit(EXIT_FAILURE);
+        }
+        address.sun_family = AF_UNIX;
+        strcpy(address.sun_path, unix_path.c_str());
+        unlink(unix_path.c_str());
+
+        if (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0) 
+        {
+            perror("Bind failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    else 
+    {
+        struct sockaddr_in address;
+        if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) 
+        {
+            perror("Socket failed");
+            exit(EXIT_FAILURE);
+        }
+
+        int reuse = 1;
+        setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = INADDR_ANY;
+        address.sin_port = htons(port);
+
+        if (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0) 
+        {
+            perror("Bind failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (listen(server_fd, SOMAXCONN) < 0) 
+    {
+        perror("Listen failed");
+        exit(EXIT_FAILURE);
+    }
+    return server_fd;
+}
+
+// Shares the ticket key between server processes (e.g. backends behind a proxy); created if missing
+static bool loadTicketKey(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::string key((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (key.length() >= 32) 
+    {
+        ticket_key = key.substr(0, 32);
+        return true;
+    }
+
+    if (!randomBytes(ticket_key, 32)) return false;
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) return false;
+    bool ok = write(fd, ticket_key.data(), ticket_key.length()) == static_cast<ssize_t>(ticket_key.length());
+    close(fd);
+    return ok;
+}
+
+// Reads a password from stdin without echoing it and prints the users.json entry for it
+static int printPasswordHash(unsigned int iterations)
+{
+    struct termios saved;
+    bool terminal = isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &saved) == 0;
+    if (terminal) 
+    {
+        struct termios quiet = saved;
+        quiet.c_lflag &= ~ECHO;
+        tcsetattr(STDIN_FILENO, TCSANOW, &quiet);
+        std::cerr << "Password: " << std::flush;
+    }
+
+    std::string password;
+    bool read_ok = static_cast<bool>(std::getline(std::cin, password));
+    if (terminal) 
+    {
+        tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+        std::cerr << std::endl;
+    }
+    if (!read_ok || password.empty()) 
+    {
+        std::cerr << "No password given" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::string hash = hashPassword(password, iterations);
+    if (hash.empty()) 
+    {
+        std::cerr << "Could not read random bytes for the salt" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << hash << std::endl;
+    return 0;
+}
+
+static void usage(const char* program)
+{
+    std::cerr << "Usage: " << program << " [--interactive-mode] [--port n | --unix path] [--ticket-lifetime s] [--ticket-key-file path]\n"
+              << "  [--max-procs n] [--max-files n] [--memory-max size] [--cpu-weight 1-10000] [--thread-stack size]\n"
+              << "  [--proxy --backend addr... [--balance least|hash] [--health-interval s]]\n"
+              << "  [--auth-workers n] [--auth-queue n] [--login-rate per-minute] [--credential-cache-ttl s]\n"
+              << "  [--hash-password [--hash-iterations n]]" << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+// Numeric option values are checked in full, so a typo stops the server instead of becoming 0 or an exception
+static long longOption(char* argv[], int& i, long min, long max)
+{
+    const char* option = argv[i];
+    const char* text = argv[++i];
+    char* end;
+    errno = 0;
+    long value = strtol(text, &end, 10);
+    if (errno != 0 || end == text || *end != '\0' || value < min || value > max) 
+    {
+        std::cerr << "Invalid value for " << option << ": " << text << std::endl;
+        usage(argv[0]);
+    }
+    return value;
+}
+
+static double doubleOption(char* argv[], int& i)
+{
+    const char* option = argv[i];
+    const char* text = argv[++i];
+    char* end;
+    errno = 0;
+    double value = strtod(text, &end);
+    if (errno != 0 || end == text || *end != '\0' || !(value >= 0)) 
+    {
+        std::cerr << "Invalid value for " << option << ": " << text << std::endl;
+        usage(argv[0]);
+    }
+    return value;
+}
+
+// Sizes like "512M", see parseSize()
+static long long sizeOption(char* argv[], int& i)
+{
+    long long value = parseSize(argv[i + 1]);
+    if (value < 0) 
+    {
+        std::cerr << "Invalid size for " << argv[i] << ": " << argv[i + 1] << std::endl;
+        usage(argv[0]);
+    }
+    i++;
+    return value;
+}
+
 int main(int argc, char* argv[]) 
 {
     bool interactive_mode = false;
+    bool proxy_mode = false;
+    int port = PORT;
+    std::string unix_path, ticket_key_file;
+    size_t thread_stack = DEFAULT_THREAD_STACK;
+    ResourcePolicy session_policy;
+    ProxyConfig proxy_config;
+    AuthConfig auth_config;
+    bool hash_password = false;
+    unsigned int hash_iterations = PASSWORD_HASH_ITERATIONS;
     
     // Parse command line arguments
     for (int i = 1; i < argc; ++i)
     {
-        if (std::string(argv[i]) == "--interactive-mode") 
+        std::string arg = argv[i];
+        if (arg == "--interactive-mode") interactive_mode = true;
+        else if (arg == "--port" && i + 1 < argc) port = longOption(argv, i, 1, 65535);
+        else if (arg == "--unix" && i + 1 < argc) unix_path = argv[++i];
+        else if (arg == "--ticket-lifetime" && i + 1 < argc) ticket_lifetime = longOption(argv, i, 0, LONG_MAX);
+        else if (arg == "--ticket-key-file" && i + 1 < argc) ticket_key_file = argv[++i];
+        else if (arg == "--max-procs" && i + 1 < argc) session_policy.max_procs = longOption(argv, i, 0, LONG_MAX);
+        else if (arg == "--max-files" && i + 1 < argc) session_policy.max_files = longOption(argv, i, 0, LONG_MAX);
+        else if (arg == "--memory-max" && i + 1 < argc) session_policy.memory_max = sizeOption(argv, i);
+        else if (arg == "--cpu-weight" && i + 1 < argc) session_policy.cpu_weight = longOption(argv, i, 0, 10000);
+        else if (arg == "--thread-stack" && i + 1 < argc) thread_stack = std::max<long long>(MIN_THREAD_STACK, sizeOption(argv, i));
+        else if (arg == "--proxy") proxy_mode = true;
+        else if (arg == "--backend" && i + 1 < argc) proxy_config.backends.push_back(argv[++i]);
+        else if (arg == "--balance" && i + 1 < argc) 
         {
-            interactive_mode = true;
-            break;
+            std::string mode = argv[++i];
+            if (mode == "least") proxy_config.mode = BalanceMode::LeastSessions;
+            else if (mode == "hash") proxy_config.mode = BalanceMode::HashByUser;
+            else 
+            {
+                std::cerr << "Invalid value for --balance: " << mode << std::endl;
+                usage(argv[0]);
+            }
         }
+        else if (arg == "--health-interval" && i + 1 < argc) proxy_config.health_interval = longOption(argv, i, 1, INT_MAX);
+        else if (arg == "--auth-workers" && i + 1 < argc) auth_config.workers = longOption(argv, i, 0, 1024);
+        else if (arg == "--auth-queue" && i + 1 < argc) auth_config.queue_limit = longOption(argv, i, 1, LONG_MAX);
+        else if (arg == "--login-rate" && i + 1 < argc) auth_config.attempts_per_minute = std::max(1.0, doubleOption(argv, i));
+        else if (arg == "--credential-cache-ttl" && i + 1 < argc) auth_config.cache_ttl = longOption(argv, i, 0, INT_MAX);
+        else if (arg == "--hash-password") hash_password = true;
+        else if (arg == "--hash-iterations" && i + 1 < argc) hash_iterations = longOption(argv, i, 1, MAX_HASH_ITERATIONS);
     }
 
-    int server_fd;
-    struct sockaddr_in address;
-    
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) 
+    if (hash_password) return printPasswordHash(hash_iterations);
+
+    if (proxy_mode && proxy_config.backends.empty()) 
     {
-        perror("Socket failed");
+        std::cerr << "Proxy mode needs at least one --backend host:port or --backend unix:/path" << std::endl;
         exit(EXIT_FAILURE);
     }
 
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(PORT);
-
-    if (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0) 
+    if (!proxy_mode) 
     {
-        perror("Bind failed");
-        exit(EXIT_FAILURE);
+        setSessionPolicy(session_policy);
+
+        // Before any thread exists, since this moves the whole process into a new cgroup
+        if (initResourceControl()) std::cout << "Using cgroup v2 for session resource limits" << std::endl;
+        else std::cout << "cgroup v2 unavailable, applying rlimits only (max_procs is not enforced)" << std::endl;
+
+        size_t plaintext = 0;
+        for (const auto& user : JsonParser::parseUsersFile("users.json")) 
+        {
+            if (!isPasswordHash(user.password)) plaintext++;
+        }
+        if (plaintext > 0) 
+        {
+            std::cout << "users.json has " << plaintext << " plaintext password(s); replace them with the output of ./server --hash-password" << std::endl;
+        }
+
+        bool have_key = ticket_key_file.empty() ? randomBytes(ticket_key, 32) : loadTicketKey(ticket_key_file);
+        if (!have_key) 
+        {
+            std::cerr << "Could not set up ticket key, session resumption disabled" << std::endl;
+            ticket_lifetime = 0;
+        }
+        deriveTicketKeys();
+
+        credential_verifier = std::make_unique<CredentialVerifier>(auth_config, findAccount);
+        credential_verifier->start();
     }
 
-    if (listen(server_fd, 5) < 0) 
+    // The accept loop waits in poll() with a timeout and checks the drain and report flags between waits
+    struct sigaction action = {};
+    action.sa_handler = requestDrain;
+    sigaction(SIGTERM, &action, nullptr);
+    sigaction(SIGINT, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    struct sigaction report_action = {};
+    report_action.sa_handler = requestReport;
+    sigaction(SIGUSR1, &report_action, nullptr);
+
+    raiseFileLimit();
+
+    // Session threads mostly sit in poll(), so they get a small stack instead of the 8 MB default
+    pthread_attr_t thread_attr;
+    pthread_attr_init(&thread_attr);
+    pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&thread_attr, thread_stack);
+    pthread_attr_getstacksize(&thread_attr, &thread_stack);
+    setSessionStackSize(thread_stack);
+
+    int server_fd = listenOn(port, unix_path);
+
+    if (unix_path.empty()) std::cout << "Server is listening on port " << port << std::endl;
+    else std::cout << "Server is listening on " << unix_path << std::endl;
+
+    std::unique_ptr<LoadBalancer> balancer;
+    if (proxy_mode) 
     {
-        perror("Listen failed");
-        exit(EXIT_FAILURE);
+        balancer = std::make_unique<LoadBalancer>(proxy_config);
+        balancer->start();
+        std::cout << "Proxying to " << proxy_config.backends.size() << " backend(s)" << std::endl;
     }
+    else if (interactive_mode) std::cout << "Default mode: interactive" << std::endl;
+    else std::cout << "Default mode: non-interactive" << std::endl;
 
-    std::cout << "Server is listening on port " << PORT << std::endl;
-    if (interactive_mode) std::cout << "Running in interactive mode" << std::endl;
-    else std::cout << "Running in non-interactive mode" << std::endl;
-
-    while (true) 
+    while (!drain_requested) 
     {
+        if (report_requested) 
+        {
+            report_requested = 0;
+            writeMemoryReport(std::cout);
+            if (credential_verifier) credential_verifier->writeReport(std::cout);
+            if (sessionLatency().legs[LEG_TOTAL].count() > 0) 
+            {
+                std::cout << "Keystroke latency, all traced sessions:\n" << sessionLatency().format(true, "\n") << std::flush;
+            }
+        }
+
+        struct pollfd pfd = {server_fd, POLLIN, 0};
+        if (poll(&pfd, 1, 500) <= 0) continue;
+
         int new_socket = accept(server_fd, NULL, NULL);
         if (new_socket < 0)
         {
-            perror("Accept failed");
+            if (errno != EINTR) perror("Accept failed");
             continue;
         }
 
-        std::thread(handle_client, new_socket, interactive_mode).detach();
+        // Session threads start with the drain and report signals blocked so only the main thread sees them
+        sigset_t drain_signals, previous;
+        sigemptyset(&drain_signals);
+        sigaddset(&drain_signals, SIGTERM);
+        sigaddset(&drain_signals, SIGINT);
+        sigaddset(&drain_signals, SIGUSR1);
+        pthread_sigmask(SIG_BLOCK, &drain_signals, &previous);
+
+        active_sessions++;
+        pthread_t thread;
+        SessionStart* start = new SessionStart{new_socket, interactive_mode, balancer.get()};
+        if (pthread_create(&thread, &thread_attr, sessionThread, start) != 0) 
+        {
+            perror("Failed to start session thread");
+            delete start;
+            close(new_socket);
+            active_sessions--;
+        }
+
+        pthread_sigmask(SIG_SETMASK, &previous, nullptr);
     }
 
+    // Closing the listener makes health checks fail, so a proxy stops sending new sessions here
     close(server_fd);
+    if (!unix_path.empty()) unlink(unix_path.c_str());
+
+    while (active_sessions > 0) 
+    {
+        std::cout << "Draining, " << active_sessions << " session(s) still active" << std::endl;
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
     return 0;
-}
\ No newline at end of file
+}
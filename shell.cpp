@@ -1,4 +1,5 @@
 #include "shell.hpp"
+#include "delta.hpp"
 #include <sstream>
 #include <sys/wait.h>
 #include <fcntl.h>
@@ -8,8 +9,16 @@
 #include <linux/limits.h>
 #include <thread>
 #include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <poll.h>
+#include <errno.h>
 
-// Utility function to split string while preserving quoted sections
+// Utility function to split string while preserving quoted sections.
+// Characters inside quotes that expandWord() treats specially are backslash-escaped.
 std::vector<std::string> tokenize(const std::string& input) 
 {
     std::vector<std::string> tokens;
@@ -35,7 +44,15 @@ std::vector<std::string> tokenize(const std::string& input)
             } 
             else token += c;
         }
-        else if (!in_quotes && (c == ' ' || c == '\t')) 
+        else if (in_quotes) 
+        {
+            // Escape characters the expansion pass would otherwise act on
+            if (c == '*' || c == '?' || c == '[' || c == '~') token += '\\';
+            else if (quote_char == '\'' && (c == '$' || c == '\\')) token += '\\';
+            else if (c == '\\' && i + 1 < input.length() && input[i+1] != '"' && input[i+1] != '$' && input[i+1] != '\\') token += '\\';
+            token += c;
+        }
+        else if (c == ' ' || c == '\t') 
         {
             if (!token.empty()) 
             {
@@ -51,10 +68,65 @@ std::vector<std::string> tokenize(const std::string& input)
     return tokens;
 }
 
-std::unique_ptr<Shell> createShell(bool interactive_mode, int socket, const std::string& username, const std::string& password) 
+void Shell::sendSlices(const Slice* header, std::initializer_list<Slice> pieces)
 {
-    if (interactive_mode) return std::make_unique<PTYShell>(socket, username, password);
-    else return std::make_unique<CommandShell>(socket, username, password);
+    IOBuffer buffer;
+    size_t used = 0;
+
+    auto append = [&](const Slice& piece) 
+    {
+        for (size_t copied = 0; copied < piece.len; ) 
+        {
+            size_t n = std::min(piece.len - copied, buffer.size() - used);
+            memcpy(buffer.data() + used, piece.data + copied, n);
+            used += n;
+            copied += n;
+
+            if (used == buffer.size()) 
+            {
+                encrypt_decrypt(buffer.data(), used, password, encrypt_counter);
+                sendAll(buffer.data(), used);
+                used = 0;
+            }
+        }
+    };
+
+    if (header) append(*header);
+    for (const Slice& piece : pieces) append(piece);
+
+    if (used > 0) 
+    {
+        encrypt_decrypt(buffer.data(), used, password, encrypt_counter);
+        sendAll(buffer.data(), used);
+    }
+}
+
+void Shell::sendFrame(char type, std::initializer_list<Slice> pieces)
+{
+    size_t len = 0;
+    for (const Slice& piece : pieces) len += piece.len;
+
+    char header[FRAME_HEADER_SIZE] = {type};
+    for (int i = 0; i < 4; ++i) header[1 + i] = static_cast<char>((len >> (24 - 8 * i)) & 0xff);
+
+    // Header and payload share one buffer, so small frames stay a single send()
+    Slice header_slice(header, FRAME_HEADER_SIZE);
+    sendSlices(&header_slice, pieces);
+}
+
+// Children inherit the server's blocked drain signals and ignored SIGPIPE across exec, so undo both
+static void resetChildSignals()
+{
+    sigset_t empty;
+    sigemptyset(&empty);
+    sigprocmask(SIG_SETMASK, &empty, nullptr);
+    signal(SIGPIPE, SIG_DFL);
+}
+
+std::unique_ptr<Shell> createShell(bool interactive_mode, int socket, const std::string& username, const std::string& password, const ResourcePolicy& policy, bool trace_latency) 
+{
+    if (interactive_mode) return std::make_unique<PTYShell>(socket, username, password, policy, trace_latency);
+    else return std::make_unique<CommandShell>(socket, username, password, policy);
 }
 
 std::vector<Pipeline> CommandShell::parseInput(const std::string& input) 
@@ -162,16 +234,269 @@ std::vector<Pipeline> CommandShell::parseInput(const std::string& input)
     return pipelines;
 }
 
+static bool isGlobChar(char c)
+{
+    return c == '*' || c == '?' || c == '[';
+}
+
+static bool hasGlobChars(const std::string& pattern)
+{
+    for (size_t i = 0; i < pattern.length(); ++i) 
+    {
+        if (pattern[i] == '\\') ++i;
+        else if (isGlobChar(pattern[i])) return true;
+    }
+    return false;
+}
+
+static std::string escapeGlob(const std::string& text)
+{
+    std::string escaped;
+    for (char c : text) 
+    {
+        if (isGlobChar(c) || c == '\\') escaped += '\\';
+        escaped += c;
+    }
+    return escaped;
+}
+
+static std::string unescape(const std::string& text)
+{
+    std::string result;
+    for (size_t i = 0; i < text.length(); ++i) 
+    {
+        if (text[i] == '\\' && i + 1 < text.length()) ++i;
+        result += text[i];
+    }
+    return result;
+}
+
+std::string CommandShell::resolvePath(const std::string& path)
+{
+    if (!path.empty() && path[0] == '/') return path;
+    const std::string& cwd = env_vars["PWD"];
+    if (path.empty() || path == ".") return cwd;
+    return cwd == "/" ? "/" + path : cwd + "/" + path;
+}
+
+void CommandShell::expandGlob(const std::vector<std::string>& components, size_t index, const std::string& prefix, bool dirs_only, std::vector<std::string>& results)
+{
+    const std::string& component = components[index];
+    bool last = index + 1 == components.size();
+
+    if (!hasGlobChars(component)) 
+    {
+        std::string path = prefix + unescape(component);
+        if (!last) 
+        {
+            expandGlob(components, index + 1, path + "/", dirs_only, results);
+            return;
+        }
+
+        // Only literal components that follow a glob end up here, so the path still has to be checked
+        struct stat st;
+        if (stat(resolvePath(path).c_str(), &st) == 0 && (!dirs_only || S_ISDIR(st.st_mode))) 
+        {
+            results.push_back(dirs_only ? path + "/" : path);
+        }
+        return;
+    }
+
+    const std::vector<DirEntry>* entries = path_index.list(resolvePath(prefix));
+    if (entries == nullptr) return;
+
+    // Matching subdirectories are collected first: listing them may evict this listing
+    std::vector<std::string> subdirs;
+    for (const auto& entry : *entries) 
+    {
+        if ((!last || dirs_only) && !entry.is_dir) continue;
+        if (fnmatch(component.c_str(), entry.name.c_str(), FNM_PERIOD) != 0) continue;
+
+        if (last) results.push_back(dirs_only ? prefix + entry.name + "/" : prefix + entry.name);
+        else subdirs.push_back(prefix + entry.name + "/");
+    }
+    for (const auto& subdir : subdirs) expandGlob(components, index + 1, subdir, dirs_only, results);
+}
+
+// Expands ~, $VAR / ${VAR} and glob patterns in a single token produced by tokenize()
+std::vector<std::string> CommandShell::expandWord(const std::string& word)
+{
+    std::string literal; // escapes removed, used when no glob applies
+    std::string pattern; // escapes kept so fnmatch() treats quoted characters literally
+    bool has_glob = false;
+    size_t i = 0;
+
+    if (!word.empty() && word[0] == '~' && (word.length() == 1 || word[1] == '/')) 
+    {
+        literal = env_vars["HOME"];
+        pattern = escapeGlob(literal);
+        i = 1;
+    }
+
+    for (; i < word.length(); ++i) 
+    {
+        char c = word[i];
+
+        if (c == '\\' && i + 1 < word.length()) 
+        {
+            literal += word[i+1];
+            pattern += word.substr(i, 2);
+            ++i;
+        }
+        else if (c == '$' && i + 1 < word.length()) 
+        {
+            size_t start = i + 1;
+            size_t end;
+            bool braced = word[start] == '{';
+            if (braced) 
+            {
+                end = word.find('}', start);
+                if (end == std::string::npos) 
+                {
+                    literal += c;
+                    pattern += c;
+                    continue;
+                }
+                start++;
+            }
+            else 
+            {
+                end = start;
+                while (end < word.length() && (isalnum(static_cast<unsigned char>(word[end])) || word[end] == '_')) end++;
+                if (end == start) 
+                {
+                    literal += c;
+                    pattern += c;
+                    continue;
+                }
+            }
+
+            // Variable values are substituted as-is and never globbed
+            auto var = env_vars.find(word.substr(start, end - start));
+            if (var != env_vars.end()) 
+            {
+                literal += var->second;
+                pattern += escapeGlob(var->second);
+            }
+            i = braced ? end : end - 1;
+        }
+        else 
+        {
+            if (isGlobChar(c)) has_glob = true;
+            literal += c;
+            pattern += c;
+        }
+    }
+
+    if (!has_glob) 
+    {
+        if (literal.empty()) return {};
+        return {literal};
+    }
+
+    std::vector<std::string> components;
+    std::string component;
+    for (size_t j = 0; j < pattern.length(); ++j) 
+    {
+        if (pattern[j] == '\\' && j + 1 < pattern.length()) 
+        {
+            component += pattern.substr(j++, 2);
+        }
+        else if (pattern[j] == '/') 
+        {
+            if (!component.empty()) components.push_back(component);
+            component.clear();
+        }
+        else component += pattern[j];
+    }
+    if (!component.empty()) components.push_back(component);
+
+    std::vector<std::string> results;
+    if (!components.empty()) 
+    {
+        expandGlob(components, 0, pattern[0] == '/' ? "/" : "", pattern.back() == '/', results);
+    }
+
+    // Like bash without nullglob, a pattern with no matches is passed through unchanged
+    if (results.empty()) return {literal};
+    return results;
+}
+
+void CommandShell::expandCommand(Command& cmd)
+{
+    // Apply directory changes before expanding, so globs see what's on disk now
+    path_index.refresh();
+
+    std::vector<std::string> args;
+    for (const auto& arg : cmd.args) 
+    {
+        auto words = expandWord(arg);
+        args.insert(args.end(), words.begin(), words.end());
+    }
+    cmd.args = std::move(args);
+
+    for (std::string* file : {&cmd.input_file, &cmd.output_file, &cmd.error_file}) 
+    {
+        if (file->empty()) continue;
+        auto words = expandWord(*file);
+        if (words.size() != 1) throw std::runtime_error("ambiguous redirect");
+        *file = words[0];
+    }
+}
+
 void CommandShell::captureAndSendOutput(int pipe_fd) 
 {
-    char buffer[4096];
+    IOBuffer buffer;
     int bytes_read;
     
-    while ((bytes_read = read(pipe_fd, buffer, sizeof(buffer))) > 0) 
+    while ((bytes_read = read(pipe_fd, buffer.data(), buffer.size())) > 0) 
+    {
+        if (capture_buffer) capture_buffer->append(buffer.data(), bytes_read);
+        else sendFrame(FRAME_OUTPUT, buffer.data(), bytes_read);
+    }
+}
+
+// Answers a completion request for the word before the cursor in `line`. The reply holds the
+// offset where that word starts followed by one replacement per line.
+void CommandShell::sendCompletions(const std::string& line)
+{
+    path_index.setSearchPath(env_vars["PATH"]);
+    path_index.refresh();
+
+    size_t start = line.find_last_of(" \t|<>&;");
+    start = start == std::string::npos ? 0 : start + 1;
+    std::string word = line.substr(start);
+
+    size_t before = line.find_last_not_of(" \t", start == 0 ? std::string::npos : start - 1);
+    bool command_position = start == 0 || before == std::string::npos || strchr("|&;", line[before]) != nullptr;
+
+    std::vector<std::string> matches;
+    if (command_position && word.find('/') == std::string::npos) 
+    {
+        path_index.completeCommand(word, MAX_COMPLETIONS, matches);
+        for (const char* builtin : {"cd", "exit"}) 
+        {
+            if (strncmp(builtin, word.c_str(), word.length()) == 0) matches.push_back(builtin);
+        }
+        std::sort(matches.begin(), matches.end());
+        matches.erase(std::unique(matches.begin(), matches.end()), matches.end());
+        if (matches.size() > MAX_COMPLETIONS) matches.resize(MAX_COMPLETIONS);
+    }
+    else 
     {
-        encrypt_decrypt(buffer, bytes_read, password, encrypt_counter);
-        send(client_socket, buffer, bytes_read, 0);
+        size_t slash = word.rfind('/');
+        std::string dir_part = slash == std::string::npos ? "" : word.substr(0, slash + 1);
+        std::string dir = dir_part;
+        if (dir.compare(0, 2, "~/") == 0) dir = env_vars["HOME"] + dir.substr(1);
+
+        std::vector<std::string> names;
+        path_index.completeFile(resolvePath(dir), word.substr(dir_part.length()), MAX_COMPLETIONS, names);
+        for (const auto& name : names) matches.push_back(dir_part + name);
     }
+
+    std::string reply = std::to_string(start);
+    for (const auto& match : matches) reply += "\n" + match;
+    sendFrame(FRAME_COMPLETIONS, reply.c_str(), reply.length());
 }
 
 void CommandShell::executeCommand(const Command& cmd, int input_fd, int output_fd) 
@@ -179,15 +504,15 @@ void CommandShell::executeCommand(const Command& cmd, int input_fd, int output_f
      // Special handling for cd command
     if (!cmd.args.empty() && cmd.args[0] == "cd") {
         std::string new_path = cmd.args.size() > 1 ? cmd.args[1] : env_vars["HOME"];
+        last_status = 1;
         if (chdir(new_path.c_str()) == 0) {
-            char cwd[PATH_MAX];
-            if (getcwd(cwd, sizeof(cwd)) != nullptr) {
-                env_vars["PWD"] = cwd;
+            if (currentDirectory(env_vars["PWD"])) {
+                last_status = 0;
             } else {
-                sendEncryptedMessage("Error getting current directory\n");
+                sendOutput("Error getting current directory\n");
             }
         } else {
-            sendEncryptedMessage("cd: No such file or directory\n");
+            sendOutput("cd: No such file or directory\n");
         }
         return;
     }
@@ -195,14 +520,16 @@ void CommandShell::executeCommand(const Command& cmd, int input_fd, int output_f
     int stdout_pipe[2];
     if (pipe(stdout_pipe) == -1) 
     {
-        sendEncryptedMessage("Error: Failed to create pipe\n");
+        sendOutput("Error: Failed to create pipe\n");
+        last_status = 1;
         return;
     }
 
     pid_t pid = fork();
     if (pid == -1) 
     {
-        sendEncryptedMessage("Error: Fork failed\n");
+        sendOutput("Error: Fork failed\n");
+        last_status = 1;
         close(stdout_pipe[0]);
         close(stdout_pipe[1]);
         return;
@@ -224,7 +551,7 @@ void CommandShell::executeCommand(const Command& cmd, int input_fd, int output_f
             if (fd == -1) 
             {
                 perror("open input file failed");
-                exit(1);
+                _exit(1);
             }
             dup2(fd, STDIN_FILENO);
             close(fd);
@@ -244,7 +571,7 @@ void CommandShell::executeCommand(const Command& cmd, int input_fd, int output_f
             if (fd == -1) 
             {
                 perror("open output file failed");
-                exit(1);
+                _exit(1);
             }
             dup2(fd, STDOUT_FILENO);
             close(fd);
@@ -264,13 +591,16 @@ void CommandShell::executeCommand(const Command& cmd, int input_fd, int output_f
         {
             setenv(key.c_str(), value.c_str(), 1);
         }
+        resources.applyToChild();
+        resetChildSignals();
         
         execvp(args[0], args.data());
         
-        // If we get here, execvp failed
+        // If we get here, execvp failed. _exit, not exit: static destructors would join server threads that
+        // don't exist in this child
         std::string error = "Error: Command '" + cmd.args[0] + "' failed to execute\n";
         write(stdout_pipe[1], error.c_str(), error.length());
-        exit(1);
+        _exit(1);
     }
     
     // Parent process
@@ -282,13 +612,20 @@ void CommandShell::executeCommand(const Command& cmd, int input_fd, int output_f
         int status;
         waitpid(pid, &status, 0);
         
-        if (WIFEXITED(status) && WEXITSTATUS(status) != 0) 
+        if (WIFEXITED(status)) last_status = WEXITSTATUS(status);
+        else if (WIFSIGNALED(status)) last_status = 128 + WTERMSIG(status);
+
+        if (report_status && WIFEXITED(status) && WEXITSTATUS(status) != 0) 
         {
             std::string error = "Command exited with status " + std::to_string(WEXITSTATUS(status)) + "\n";
-            sendEncryptedMessage(error);
+            sendOutput(error);
         }
     }
-    else close(stdout_pipe[0]);
+    else 
+    {
+        close(stdout_pipe[0]);
+        last_status = 0;
+    }
 }
 
 void CommandShell::executePipeline(const Pipeline& pipeline) 
@@ -320,43 +657,182 @@ void CommandShell::executePipeline(const Pipeline& pipeline)
     }
 }
 
+void CommandShell::executeInput(const std::string& input)
+{
+    try 
+    {
+        auto pipelines = parseInput(input);
+        for (auto& pipeline : pipelines) 
+        {
+            for (auto& cmd : pipeline.commands) expandCommand(cmd);
+
+            // Commands that expanded to nothing (e.g. an unset $VAR) are dropped
+            pipeline.commands.erase(std::remove_if(pipeline.commands.begin(), pipeline.commands.end(), 
+                                    [](const Command& cmd) { return cmd.args.empty(); }), pipeline.commands.end());
+            if (!pipeline.commands.empty()) executePipeline(pipeline);
+        }
+    }
+    catch (const std::exception& e) 
+    {
+        std::string error = "Error parsing command: " + std::string(e.what()) + "\n";
+        sendOutput(error);
+        last_status = 2;
+    }
+}
+
 void CommandShell::run() 
 {
-    char buffer[4096];
-    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    FrameReader frames;
+    char type;
+    std::string input;
+    bool error;
+
+    sendPrompt();
     while (true)
     {
-        sendPrompt();
-        
-        int bytes_read = read(client_socket, buffer, sizeof(buffer) - 1);
-        if (bytes_read <= 0) break;
-        
-        encrypt_decrypt(buffer, bytes_read, password, decrypt_counter);
-        buffer[bytes_read] = '\0';
-        std::string input(buffer);
-        if(input == "exit") break;
-    
-        if (input.empty() || input == "\n") continue;
-        
-        try 
+        updateAccount();
+
+        // Wait without a buffer, so idle sessions don't hold one
+        struct pollfd pfd = {client_socket, POLLIN, 0};
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR) break;
+
+        {
+            IOBuffer buffer;
+            int bytes_read = read(client_socket, buffer.data(), buffer.size());
+            if (bytes_read <= 0) break;
+
+            encrypt_decrypt(buffer.data(), bytes_read, password, decrypt_counter);
+            frames.feed(buffer.data(), bytes_read);
+        }
+
+        while (frames.next(type, input, error)) 
+        {
+            if (type == FRAME_COMPLETE) 
+            {
+                sendCompletions(input);
+                continue;
+            }
+            if (type != FRAME_INPUT) continue;
+            if (input == "exit") return;
+
+            if (!input.empty() && input != "\n") 
+            {
+                executeInput(input);
+                std::string status = std::to_string(last_status);
+                sendFrame(FRAME_EXIT, status.c_str(), status.length());
+            }
+            sendPrompt();
+        }
+        if (error) break;
+    }
+}
+
+void CommandShell::runOnce(const std::string& input)
+{
+    account.kind = "exec";
+    report_status = false;
+    executeInput(input);
+    std::string status = std::to_string(last_status);
+    sendFrame(FRAME_EXIT, status.c_str(), status.length());
+}
+
+void CommandShell::runWatch(const std::string& input, double interval)
+{
+    account.kind = "watch";
+    report_status = false;
+    std::vector<std::string> previous;
+    std::string output;
+
+    while (true) 
+    {
+        output.clear();
+        capture_buffer = &output;
+        executeInput(input);
+        capture_buffer = nullptr;
+
+        // Only the lines that changed since the last run go over the wire
+        std::vector<std::string> current = splitLines(output);
+        std::string delta = encodeLineDelta(previous, current);
+        sendFrame(FRAME_WATCH, delta.data(), delta.length());
+        previous = std::move(current);
+        updateAccount();
+
+        // Sleep until the next run, but stop as soon as the client disconnects
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(interval);
+        while (true) 
         {
-            auto pipelines = parseInput(input);
-            for (const auto& pipeline : pipelines) 
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+            if (remaining <= 0) break;
+
+            // poll() rather than select(), which can't handle descriptors past FD_SETSIZE
+            struct pollfd pfd = {client_socket, POLLIN, 0};
+            if (poll(&pfd, 1, static_cast<int>(remaining)) > 0) 
             {
-                executePipeline(pipeline);
+                IOBuffer buffer;
+                int bytes_read = read(client_socket, buffer.data(), buffer.size());
+                if (bytes_read <= 0) return;
+                encrypt_decrypt(buffer.data(), bytes_read, password, decrypt_counter);
             }
         }
-        catch (const std::exception& e) 
+    }
+}
+
+void PTYShell::handleTracedInput(FrameReader& frames, std::vector<ProbeTimes>& pending, std::vector<ProbeTimes>& unreported)
+{
+    char type;
+    std::string payload, keys;
+    bool error;
+    while (frames.next(type, payload, error)) 
+    {
+        if (type == FRAME_INPUT) write(master_fd, payload.data(), payload.length());
+        else if (type == FRAME_PROBE) 
+        {
+            ProbeTimes times;
+            if (!decodeProbeRequest(payload, times, keys)) continue;
+            times.server_received = monotonicMicros();
+            write(master_fd, keys.data(), keys.length());
+            pending.push_back(times);
+        }
+        else if (type == FRAME_PROBE_RESULT) 
         {
-            std::string error = "Error parsing command: " + std::string(e.what()) + "\n";
-            sendEncryptedMessage(error);
+            // Only results for probes this session answered count, each once, and bounded by its stamps
+            uint64_t id, samples[LEG_COUNT];
+            if (!decodeProbeResult(payload, id, samples)) continue;
+            auto probe = std::find_if(unreported.begin(), unreported.end(), [id](const ProbeTimes& times) { return times.id == id; });
+            if (probe == unreported.end()) continue;
+            clampProbeResult(*probe, monotonicMicros(), samples);
+            unreported.erase(probe);
+            sessionLatency().add(samples);
         }
     }
 }
 
+// The first PTY output after a probed keystroke is taken as its echo. Probes the PTY never
+// answered (echo off, or nothing to print) are dropped rather than matched to unrelated output.
+// Replies go out in the same send() as the echo, so a probe never waits behind it on Nagle.
+void PTYShell::sendTracedOutput(const char* data, size_t len, std::vector<ProbeTimes>& pending, std::vector<ProbeTimes>& unreported)
+{
+    uint64_t answered = monotonicMicros();
+    std::string frames;
+    appendFrame(frames, FRAME_OUTPUT, data, len);
+
+    for (ProbeTimes& times : pending) 
+    {
+        if (answered - times.server_received > PROBE_TIMEOUT_US) continue;
+        times.pty_answered = answered;
+        times.server_sent = monotonicMicros();
+        std::string reply = encodeProbeReply(times);
+        appendFrame(frames, FRAME_PROBE, reply.data(), reply.length());
+
+        unreported.push_back(times);
+        if (unreported.size() > MAX_UNREPORTED_PROBES) unreported.erase(unreported.begin());
+    }
+    pending.clear();
+    sendEncrypted({frames});
+}
+
 void PTYShell::run()
 {
-    int master_fd;
     pid_t pid = forkpty(&master_fd, nullptr, nullptr, nullptr);
     if (pid == -1)
     {
@@ -375,39 +851,56 @@ void PTYShell::run()
         setenv("PS1", ps1.c_str(), 1);
         setenv("LS_OPTIONS", "--color=auto", 1);
         setenv("CLICOLOR", "1", 1);
+        resources.applyToChild();
+        resetChildSignals();
         
         execl("/bin/bash", "bash", "--norc", nullptr);
         perror("execl failed");
-        exit(1);
+        _exit(1);
     }
 
-    char buffer[4096];
-    fd_set readfds;
+    // poll() rather than select(), since with thousands of sessions descriptors go past FD_SETSIZE
+    struct pollfd fds[2] = {{client_socket, POLLIN, 0}, {master_fd, POLLIN, 0}};
+    FrameReader frames;
+    std::vector<ProbeTimes> pending; // probes whose keystrokes the PTY hasn't answered yet
+    std::vector<ProbeTimes> unreported; // answered probes whose results the client hasn't reported yet
 
     while (true) 
     {
-        FD_ZERO(&readfds);
-        FD_SET(client_socket, &readfds);
-        FD_SET(master_fd, &readfds);
-
-        if (select(std::max(client_socket, master_fd) + 1, &readfds, nullptr, nullptr, nullptr) < 0) break;
+        updateAccount();
+        if (poll(fds, 2, -1) < 0) 
+        {
+            if (errno == EINTR) continue;
+            break;
+        }
 
-        if (FD_ISSET(client_socket, &readfds)) 
+        // The buffer is only taken while data is moving, so idle sessions hold none
+        IOBuffer buffer;
+        if (fds[0].revents) 
         {
-            int bytes_read = read(client_socket, buffer, sizeof(buffer));
+            int bytes_read = read(client_socket, buffer.data(), buffer.size());
             if (bytes_read <= 0) break;
 
-            encrypt_decrypt(buffer, bytes_read, password, decrypt_counter);
-            write(master_fd, buffer, bytes_read);
+            encrypt_decrypt(buffer.data(), bytes_read, password, decrypt_counter);
+            if (trace_latency) 
+            {
+                frames.feed(buffer.data(), bytes_read);
+                handleTracedInput(frames, pending, unreported);
+            }
+            else write(master_fd, buffer.data(), bytes_read);
         }
 
-        if (FD_ISSET(master_fd, &readfds)) 
+        if (fds[1].revents) 
         {
-            int bytes_read = read(master_fd, buffer, sizeof(buffer));
+            int bytes_read = read(master_fd, buffer.data(), buffer.size());
             if (bytes_read <= 0) break;
 
-            encrypt_decrypt(buffer, bytes_read, password, encrypt_counter);
-            send(client_socket, buffer, bytes_read, 0);
+            if (trace_latency) sendTracedOutput(buffer.data(), bytes_read, pending, unreported);
+            else 
+            {
+                encrypt_decrypt(buffer.data(), bytes_read, password, encrypt_counter);
+                send(client_socket, buffer.data(), bytes_read, 0);
+            }
         }
     }
 
@@ -2,13 +2,66 @@
 #include <string>
 #include <vector>
 #include <memory>
-#include <unordered_map>
+#include <initializer_list>
+#include <algorithm>
 #include <sys/socket.h>
 #include <string.h>
 #include <linux/limits.h>
 #include <unistd.h>
+#include <time.h>
+#include "crypto.hpp"
+#include "resources.hpp"
+#include "protocol.hpp"
+#include "pathindex.hpp"
+#include "memory.hpp"
+#include "latency.hpp"
 
-void encrypt_decrypt(char* data, size_t len, const std::string& key, unsigned long long& counter);
+// Session variables. A session only carries a handful, so a flat vector is much smaller than a hash map.
+class Environment
+{
+private:
+    std::vector<std::pair<std::string, std::string>> vars;
+
+public:
+    std::string& operator[](const std::string& name)
+    {
+        for (auto& var : vars) if (var.first == name) return var.second;
+        vars.emplace_back(name, std::string());
+        return vars.back().second;
+    }
+
+    using const_iterator = std::vector<std::pair<std::string, std::string>>::const_iterator;
+    const_iterator begin() const { return vars.begin(); }
+    const_iterator end() const { return vars.end(); }
+    const_iterator find(const std::string& name) const
+    {
+        return std::find_if(vars.begin(), vars.end(), [&](const auto& var) { return var.first == name; });
+    }
+
+    size_t memoryUsage() const
+    {
+        size_t bytes = vars.capacity() * sizeof(vars[0]);
+        for (const auto& var : vars) bytes += heapBytes(var.first) + heapBytes(var.second);
+        return bytes;
+    }
+
+    static size_t heapBytes(const std::string& text)
+    {
+        // Short strings live inside the object itself
+        return text.capacity() > 15 ? text.capacity() + 1 : 0;
+    }
+};
+
+// A piece of an outgoing message, so messages can be sent without first concatenating them
+struct Slice
+{
+    const char* data;
+    size_t len;
+
+    Slice(const char* text) : data(text), len(strlen(text)) {}
+    Slice(const char* bytes, size_t length) : data(bytes), len(length) {}
+    Slice(const std::string& text) : data(text.data()), len(text.length()) {}
+};
 
 class Shell
 {
@@ -16,63 +69,110 @@ protected:
     int client_socket;
     std::string username;
     std::string password;
-    std::unordered_map<std::string, std::string> env_vars;
+    Environment env_vars;
     unsigned long long encrypt_counter;
     unsigned long long decrypt_counter;
+    SessionResources resources;
+    SessionAccount account;
 
 public:
-    Shell(int socket, const std::string& user, const std::string& pass) 
-        : client_socket(socket), username(user), password(pass), encrypt_counter(0), decrypt_counter(0)
+    Shell(int socket, const std::string& user, const std::string& pass, const ResourcePolicy& policy, SessionClass session_class) 
+        : client_socket(socket), username(user), password(pass), encrypt_counter(0), decrypt_counter(0), 
+          resources(user, policy, session_class)
     {
         setupEnvironment();
+        account.username = user;
+        account.started = time(nullptr);
+        registerSession(&account);
     }
     
-    virtual ~Shell() = default;
+    virtual ~Shell() { unregisterSession(&account); }
     virtual void run() = 0;
 
+    // Sessions come from the session object pools rather than the thread's malloc arena
+    static void* operator new(size_t size) { return allocateSessionObject(size); }
+    static void operator delete(void* object, size_t size) { releaseSessionObject(object, size); }
+
 protected:
     virtual void setupEnvironment() 
     {
         env_vars["PATH"] = "/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin";
         env_vars["HOME"] = "/home";
 
-        char cwd[PATH_MAX];
-        if (getcwd(cwd, sizeof(cwd)) != nullptr) env_vars["PWD"] = cwd;
-        else env_vars["PWD"] = "/"; // Fallback if getcwd fails
+        if (!currentDirectory(env_vars["PWD"])) env_vars["PWD"] = "/"; // Fallback if getcwd fails
+    }
+
+    // getcwd() into a heap buffer: a PATH_MAX array would leave an extra stack page resident per session
+    static bool currentDirectory(std::string& path)
+    {
+        char* cwd = getcwd(nullptr, 0);
+        if (cwd == nullptr) return false;
+        path = cwd;
+        free(cwd);
+        return true;
+    }
+
+    // Heap memory owned by this session, including the object itself
+    virtual size_t memoryUsage() const
+    {
+        return Environment::heapBytes(username) + Environment::heapBytes(password) + env_vars.memoryUsage();
     }
 
+    // Publishes the current figure for the memory report; only called from the session thread
+    void updateAccount() { account.heap_bytes = memoryUsage(); }
+
     virtual void sendPrompt() 
     {
-        std::string cwd = env_vars["PWD"];
-        std::string prompt = "\033[1;36m[MySSH]\033[1;33m" + username + ":" + cwd + "\033[0m$ ";
-        char* encrypted_prompt = new char[prompt.length()];
-        memcpy(encrypted_prompt, prompt.c_str(), prompt.length());
-        encrypt_decrypt(encrypted_prompt, prompt.length(), password, encrypt_counter);
-        send(client_socket, encrypted_prompt, prompt.length(), 0);
-        delete[] encrypted_prompt;
+        sendEncrypted({"\033[1;36m[MySSH]\033[1;33m", username, ":", env_vars["PWD"], "\033[0m$ "});
     }
 
-    void sendEncryptedMessage(const std::string& message) 
+    void sendAll(const char* data, size_t len)
     {
-        char* encrypted_msg = new char[message.length()];
-        memcpy(encrypted_msg, message.c_str(), message.length());
-        encrypt_decrypt(encrypted_msg, message.length(), password, encrypt_counter);
-        send(client_socket, encrypted_msg, message.length(), 0);
-        delete[] encrypted_msg;
+        while (len > 0) 
+        {
+            ssize_t sent = send(client_socket, data, len, 0);
+            if (sent <= 0) return;
+            data += sent;
+            len -= sent;
+        }
     }
+
+    // Copies the pieces into a pooled buffer, encrypts them in place and sends them a buffer at a time
+    void sendSlices(const Slice* header, std::initializer_list<Slice> pieces);
+    void sendEncrypted(std::initializer_list<Slice> pieces) { sendSlices(nullptr, pieces); }
+
+    // Encrypts and sends one frame of the framed session protocol
+    void sendFrame(char type, std::initializer_list<Slice> pieces);
+
+    void sendFrame(char type, const char* data, size_t len) { sendFrame(type, {Slice(data, len)}); }
+
+    void sendEncryptedMessage(const std::string& message) { sendEncrypted({message}); }
 };
 
 class PTYShell : public Shell 
 {
 private:
     int master_fd;
+    bool trace_latency; // framed stream with keystroke latency probes
+
+    void handleTracedInput(FrameReader& frames, std::vector<ProbeTimes>& pending, std::vector<ProbeTimes>& unreported);
+    void sendTracedOutput(const char* data, size_t len, std::vector<ProbeTimes>& pending, std::vector<ProbeTimes>& unreported);
 
 public:
-    PTYShell(int socket, const std::string& user, const std::string& pass) 
-        : Shell(socket, user, pass) {}
+    PTYShell(int socket, const std::string& user, const std::string& pass, const ResourcePolicy& policy, bool trace = false) 
+        : Shell(socket, user, pass, policy, SessionClass::Interactive), trace_latency(trace) 
+    {
+        account.kind = "interactive";
+    }
     void run() override;
+
+protected:
+    size_t memoryUsage() const override { return sizeof(*this) + Shell::memoryUsage(); }
 };
 
+// Splits a command line on blanks, keeping quoted sections together
+std::vector<std::string> tokenize(const std::string& input);
+
 struct Command 
 {
     std::vector<std::string> args;
@@ -92,15 +192,52 @@ struct Pipeline
 class CommandShell : public Shell 
 {
 private:
+    friend class ShellBench; // bench.cpp times the parser and the spawn path on their own
+
+    PathIndex path_index;
+
+    int last_status = 0;
+    bool report_status = true; // print "Command exited with status" for failed commands
+    std::string* capture_buffer = nullptr; // when set, output is collected here instead of sent
+
     std::vector<Pipeline> parseInput(const std::string& input);
+    void executeInput(const std::string& input);
+    void expandCommand(Command& cmd);
+    std::vector<std::string> expandWord(const std::string& word);
+    void expandGlob(const std::vector<std::string>& components, size_t index, const std::string& prefix, bool dirs_only, std::vector<std::string>& results);
+    std::string resolvePath(const std::string& path);
     void executePipeline(const Pipeline& pipeline);
     void executeCommand(const Command& cmd, int input_fd, int output_fd);
     void captureAndSendOutput(int pipe_fd);
+    void sendCompletions(const std::string& line);
+
+    void sendOutput(const std::string& message) 
+    {
+        if (capture_buffer) capture_buffer->append(message);
+        else sendFrame(FRAME_OUTPUT, message.c_str(), message.length());
+    }
+
+protected:
+    void sendPrompt() override 
+    {
+        sendFrame(FRAME_PROMPT, {"\033[1;36m[MySSH]\033[1;33m", username, ":", env_vars["PWD"], "\033[0m$ "});
+    }
+
+    size_t memoryUsage() const override { return sizeof(*this) + Shell::memoryUsage() + path_index.memoryUsage(); }
 
 public:
-    CommandShell(int socket, const std::string& user, const std::string& pass) 
-        : Shell(socket, user, pass) {}
+    CommandShell(int socket, const std::string& user, const std::string& pass, const ResourcePolicy& policy) 
+        : Shell(socket, user, pass, policy, SessionClass::Batch) 
+    {
+        account.kind = "command";
+    }
     void run() override;
+
+    // Exec mode: runs a single command line and reports its exit status
+    void runOnce(const std::string& input);
+
+    // Watch mode: re-runs a command line every `interval` seconds and sends line deltas
+    void runWatch(const std::string& input, double interval);
 };
 
-std::unique_ptr<Shell> createShell(bool interactive_mode, int socket, const std::string &username, const std::string &password);
\ No newline at end of file
+std::unique_ptr<Shell> createShell(bool interactive_mode, int socket, const std::string &username, const std::string &password, const ResourcePolicy& policy, bool trace_latency = false);
\ No newline at end of file
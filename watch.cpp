@@ -0,0 +1,256 @@
+#include "watch.hpp"
+#include "crypto.hpp"
+#include "delta.hpp"
+#include "protocol.hpp"
+#include <algorithm>
+#include <vector>
+#include <locale.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+
+#define HEADER_ROWS 2
+#define TAB_WIDTH 8
+
+// Decodes the UTF-8 character at `pos`; returns its length in bytes, or 0 for a malformed or cut-off sequence
+static size_t decodeUtf8(const std::string& text, size_t pos, wchar_t& code)
+{
+    unsigned char lead = text[pos];
+    size_t len = lead < 0x80 ? 1 : (lead & 0xe0) == 0xc0 ? 2 : (lead & 0xf0) == 0xe0 ? 3 : (lead & 0xf8) == 0xf0 ? 4 : 0;
+    if (len == 0 || pos + len > text.length()) return 0;
+
+    code = len == 1 ? lead : lead & (0x7f >> len);
+    for (size_t i = 1; i < len; i++) 
+    {
+        unsigned char next = text[pos + i];
+        if ((next & 0xc0) != 0x80) return 0;
+        code = (code << 6) | (next & 0x3f);
+    }
+    return len;
+}
+
+// Skips the escape sequence at `pos` and returns the index after it: CSI (ESC [ ... final byte),
+// OSC (ESC ] ... terminated by BEL or ST), or ESC plus one byte
+static size_t skipEscape(const std::string& text, size_t pos)
+{
+    size_t i = pos + 1;
+    if (i >= text.length()) return i;
+    if (text[i] == '[') 
+    {
+        for (i++; i < text.length(); i++) 
+        {
+            unsigned char c = text[i];
+            if (c >= 0x40 && c <= 0x7e) return i + 1;
+        }
+        return i;
+    }
+    if (text[i] == ']') 
+    {
+        for (i++; i < text.length(); i++) 
+        {
+            if (text[i] == '\a') return i + 1;
+            if (text[i] == '\x1b' && i + 1 < text.length() && text[i + 1] == '\\') return i + 2;
+        }
+        return i;
+    }
+    return i + 1;
+}
+
+// Cuts a line of command output down to `cols` terminal columns without splitting a character.
+// Colour (SGR) sequences are kept; other escape sequences and control characters are dropped,
+// since they could move the cursor or change modes outside this line. Tabs become spaces.
+static std::string clipToColumns(const std::string& text, size_t cols)
+{
+    std::string clipped;
+    size_t used = 0;
+    size_t pos = 0;
+    while (pos < text.length() && used < cols) 
+    {
+        unsigned char c = text[pos];
+        if (c == 0x1b) 
+        {
+            size_t end = skipEscape(text, pos);
+            if (text[end - 1] == 'm' && end - pos > 2 && text[pos + 1] == '[') clipped.append(text, pos, end - pos);
+            pos = end;
+            continue;
+        }
+        if (c == '\t') 
+        {
+            size_t stop = std::min(cols, (used / TAB_WIDTH + 1) * TAB_WIDTH);
+            clipped.append(stop - used, ' ');
+            used = stop;
+            pos++;
+            continue;
+        }
+        if (c < 0x20 || c == 0x7f) 
+        {
+            pos++;
+            continue;
+        }
+
+        wchar_t code;
+        size_t len = decodeUtf8(text, pos, code);
+        if (len == 0) 
+        {
+            pos++;
+            continue;
+        }
+        // C1 controls, which some terminals act on like the escape sequences above
+        if (code >= 0x80 && code < 0xa0) 
+        {
+            pos += len;
+            continue;
+        }
+        // Without a UTF-8 locale wcwidth() knows nothing about non-ASCII characters; assume one column
+        int width = wcwidth(code);
+        if (width < 0) width = 1;
+        if (used + width > cols) break;
+        clipped.append(text, pos, len);
+        used += width;
+        pos += len;
+    }
+    return clipped;
+}
+
+class WatchView
+{
+private:
+    std::vector<std::string> lines;
+    std::string command;
+    double interval;
+    size_t rows = 24;
+    size_t cols = 80;
+    size_t bytes_received = 0;
+    size_t bytes_full = 0;
+
+    void moveTo(size_t row)
+    {
+        char seq[32];
+        write(STDOUT_FILENO, seq, snprintf(seq, sizeof(seq), "\x1b[%zu;1H", row + 1));
+    }
+
+    void drawLine(size_t row, const std::string& text)
+    {
+        moveTo(row);
+        std::string clipped = clipToColumns(text, cols);
+        clipped += "\x1b[0m\x1b[K";
+        write(STDOUT_FILENO, clipped.c_str(), clipped.length());
+    }
+
+public:
+    WatchView(const std::string& cmd, double seconds) : command(cmd), interval(seconds)
+    {
+        struct winsize size;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_row > HEADER_ROWS) 
+        {
+            rows = size.ws_row;
+            cols = size.ws_col;
+        }
+    }
+
+    // Applies one delta frame and repaints what changed; returns false on a corrupt frame
+    bool update(const std::string& payload)
+    {
+        std::vector<std::string> next;
+        std::vector<bool> changed;
+        if (!applyLineDelta(lines, payload, next, changed)) return false;
+
+        bool first = bytes_received == 0;
+        bytes_received += payload.length();
+        bytes_full += joinLines(next).length();
+
+        char header[256];
+        snprintf(header, sizeof(header), "Every %.1fs: %s", interval, command.c_str());
+        char stats[128];
+        snprintf(stats, sizeof(stats), "received %zu B for %zu B of output", bytes_received, bytes_full);
+        drawLine(0, std::string(header) + "    " + stats);
+
+        size_t visible = rows - HEADER_ROWS;
+        for (size_t i = 0; i < next.size() && i < visible; i++) 
+        {
+            if (first || changed[i] || i >= lines.size()) drawLine(HEADER_ROWS + i, next[i]);
+        }
+        if (next.size() < lines.size() && next.size() < visible) 
+        {
+            moveTo(HEADER_ROWS + next.size());
+            write(STDOUT_FILENO, "\x1b[J", 3);
+        }
+
+        lines = std::move(next);
+        return true;
+    }
+};
+
+int watchCommand(int sock, const std::string& session_key, std::string leftover, 
+                 const std::string& command, double interval)
+{
+    // For wcwidth() when clipping lines to the terminal width
+    setlocale(LC_CTYPE, "");
+
+    struct termios orig_termios;
+    tcgetattr(STDIN_FILENO, &orig_termios);
+    struct termios raw = orig_termios;
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+
+    // Alternate screen, cleared, cursor hidden
+    write(STDOUT_FILENO, "\x1b[?1049h\x1b[2J\x1b[?25l", 18);
+
+    WatchView view(command, interval);
+    FrameReader frames;
+    unsigned long long decrypt_counter = 0;
+    char buffer[16384];
+    int result = 0;
+
+    auto deliver = [&](char* data, size_t len) 
+    {
+        encrypt_decrypt(data, len, session_key, decrypt_counter);
+        frames.feed(data, len);
+
+        char type;
+        std::string payload;
+        bool error;
+        while (frames.next(type, payload, error)) 
+        {
+            if (type == FRAME_WATCH && !view.update(payload)) return false;
+        }
+        return !error;
+    };
+
+    // Frames that arrived with the handshake reply; a corrupt one fails the watch like any other
+    bool running = leftover.empty() || deliver(&leftover[0], leftover.length());
+    if (!running) result = 1;
+    while (running) 
+    {
+        fd_set readfds;
+        FD_ZERO(&readfds);
+        FD_SET(STDIN_FILENO, &readfds);
+        FD_SET(sock, &readfds);
+        if (select(sock + 1, &readfds, nullptr, nullptr, nullptr) < 0) break;
+
+        if (FD_ISSET(STDIN_FILENO, &readfds)) 
+        {
+            char c;
+            if (read(STDIN_FILENO, &c, 1) <= 0 || c == 'q' || c == 3) break;
+        }
+
+        if (FD_ISSET(sock, &readfds)) 
+        {
+            int bytes_read = read(sock, buffer, sizeof(buffer));
+            if (bytes_read <= 0 || !deliver(buffer, bytes_read)) 
+            {
+                result = 1;
+                break;
+            }
+        }
+    }
+
+    write(STDOUT_FILENO, "\x1b[?25h\x1b[?1049l", 14);
+    tcsetattr(STDIN_FILENO, TCSANOW, &orig_termios);
+    close(sock);
+    return result;
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include <string>
+
+// Client side of watch mode: reads line deltas from an authenticated watch session and keeps a
+// full-screen view up to date, repainting only the lines that changed. `leftover` holds stream
+// bytes that arrived together with the handshake reply. Returns when the user presses q.
+int watchCommand(int sock, const std::string& session_key, std::string leftover, 
+                 const std::string& command, double interval);